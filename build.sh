@@ -1,2 +1,6 @@
 #!/bin/sh
-clang++ -std=c++11 -O3 -Wno-c++1y-extensions -DNDEBUG -I src src/main.cpp -o tipe.out
\ No newline at end of file
+clang++ -std=c++11 -O3 -Wno-c++1y-extensions -DNDEBUG -pthread -I src src/main.cpp -o tipe.out
+# Library, link with -ltipe -pthread and include tipe.h
+clang++ -std=c++11 -O3 -Wno-c++1y-extensions -DNDEBUG -pthread -I src -c src/tipe.cpp -o tipe.o && ar rcs libtipe.a tipe.o
+# Round trip example of the library : ./tipe_example small files
+cc -O2 -I src src/tipe_example.c -L. -ltipe -lstdc++ -lm -pthread -o tipe_example
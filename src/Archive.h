@@ -0,0 +1,146 @@
+#pragma once
+
+#include "Dictionary.h"
+
+#include <cinttypes>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// --- Archive format ---
+//   "TIPA", uint8 version, uint8 model type, uint32 model parameter,
+//   uint8 filter type, uint32 filter parameter, uint8 dictionary flag,
+//   the dictionary when the flag is set, uint64 block size, uint32 entry count
+//   entries : uint16 name length, name, uint64 size
+// followed by the coded concatenation of every entry, in table order, so that
+// the model carries what it learnt from one file to the next.
+// The concatenation is cut in blocks of block size bytes (a single block when
+// the block size is 0). Each block starts from the initial model state, so it
+// can be decoded alone. Blocks are cut in chunks of ChunkSize bytes, each one
+// goes through the dictionary and the filter before the model :
+//   uint8 chunk mode, uint32 stored size, uint32 size the model sees (only
+//   with a dictionary, the chunk size otherwise), stored size bytes
+// A coded chunk has its own flushed coded stream, a stored chunk is a plain
+// copy. The archive ends with the block index :
+//   uint32 block count, uint64 offset of each block, uint32 checksum of each
+//   block, uint32 entry count, uint32 checksum of each entry,
+//   uint64 offset of the index
+// The checksums are the CRC32C of the original bytes, so they check the whole
+// chain : dictionary, filter and model.
+
+enum class ChunkMode : std::uint8_t {
+  Coded,
+  Stored,       // The model did not see the chunk
+  StoredTrained // Coding did not pay off, but the model saw the chunk
+};
+
+struct ArchiveEntry {
+  std::string name;
+  std::uint64_t size;
+};
+
+class ArchiveHeader {
+public:
+  static constexpr std::uint8_t Version = 11;
+  static constexpr std::uint32_t ChunkSize = 1 << 16;
+
+  std::uint8_t modelType = 0;
+  std::uint32_t modelParameter = 0;
+  std::uint8_t filterType = 0;
+  std::uint32_t filterParameter = 0;
+  Dictionary dictionary;
+  std::uint64_t blockSize = 0;
+  std::vector<ArchiveEntry> entries;
+
+  std::uint64_t totalSize() const {
+    std::uint64_t total = 0;
+    for(ArchiveEntry const& entry : entries) total += entry.size;
+    return total;
+  }
+
+  void write(std::ostream& stream) const {
+    stream.write("TIPA", 4);
+    stream.put(static_cast<char>(Version));
+    stream.put(static_cast<char>(modelType));
+    stream.write((char const*) &modelParameter, sizeof(std::uint32_t));
+    stream.put(static_cast<char>(filterType));
+    stream.write((char const*) &filterParameter, sizeof(std::uint32_t));
+    stream.put(dictionary.empty() ? 0 : 1);
+    if(!dictionary.empty()) dictionary.write(stream);
+    stream.write((char const*) &blockSize, sizeof(std::uint64_t));
+    std::uint32_t count = entries.size();
+    stream.write((char const*) &count, sizeof(std::uint32_t));
+    for(ArchiveEntry const& entry : entries){
+      std::uint16_t length = entry.name.size();
+      stream.write((char const*) &length, sizeof(std::uint16_t));
+      stream.write(entry.name.data(), length);
+      stream.write((char const*) &entry.size, sizeof(std::uint64_t));
+    }
+  }
+
+  bool read(std::istream& stream){
+    char magic[4];
+    stream.read(magic, 4);
+    if(!stream.good() || std::string(magic, 4) != "TIPA") return false;
+    if(stream.get() != Version) return false;
+    modelType = stream.get();
+    stream.read((char*) &modelParameter, sizeof(std::uint32_t));
+    filterType = stream.get();
+    stream.read((char*) &filterParameter, sizeof(std::uint32_t));
+    dictionary = Dictionary();
+    if(stream.get() == 1 && !dictionary.read(stream)) return false;
+    stream.read((char*) &blockSize, sizeof(std::uint64_t));
+    std::uint32_t count = 0;
+    stream.read((char*) &count, sizeof(std::uint32_t));
+    entries.clear();
+    for(std::uint32_t i = 0; i < count && stream.good(); ++i){
+      std::uint16_t length = 0;
+      stream.read((char*) &length, sizeof(std::uint16_t));
+      ArchiveEntry entry;
+      entry.name.resize(length);
+      stream.read(&entry.name[0], length);
+      stream.read((char*) &entry.size, sizeof(std::uint64_t));
+      entries.push_back(entry);
+    }
+    return stream.good();
+  }
+};
+
+class ArchiveIndex {
+public:
+  std::vector<std::uint64_t> blockOffsets;
+  std::vector<std::uint32_t> blockSums, entrySums;
+
+  void write(std::ostream& stream) const {
+    std::uint64_t position = stream.tellp();
+    std::uint32_t count = blockOffsets.size();
+    stream.write((char const*) &count, sizeof(std::uint32_t));
+    stream.write((char const*) blockOffsets.data(), count * sizeof(std::uint64_t));
+    stream.write((char const*) blockSums.data(), count * sizeof(std::uint32_t));
+    std::uint32_t entries = entrySums.size();
+    stream.write((char const*) &entries, sizeof(std::uint32_t));
+    stream.write((char const*) entrySums.data(), entries * sizeof(std::uint32_t));
+    stream.write((char const*) &position, sizeof(std::uint64_t));
+  }
+
+  bool read(std::istream& stream){
+    std::uint64_t position = 0;
+    std::uint32_t count = 0;
+    stream.seekg(-static_cast<std::streamoff>(sizeof(std::uint64_t)), std::ios::end);
+    stream.read((char*) &position, sizeof(std::uint64_t));
+    stream.seekg(position);
+    stream.read((char*) &count, sizeof(std::uint32_t));
+    if(!stream.good()) return false;
+    blockOffsets.resize(count);
+    stream.read((char*) blockOffsets.data(), count * sizeof(std::uint64_t));
+    blockSums.resize(count);
+    stream.read((char*) blockSums.data(), count * sizeof(std::uint32_t));
+    std::uint32_t entries = 0;
+    stream.read((char*) &entries, sizeof(std::uint32_t));
+    if(!stream.good()) return false;
+    entrySums.resize(entries);
+    stream.read((char*) entrySums.data(), entries * sizeof(std::uint32_t));
+    return stream.good();
+  }
+};
@@ -0,0 +1,478 @@
+#pragma once
+
+#include "Archive.h"
+#include "Encoder.h"
+#include "Decoder.h"
+#include "Model.h"
+#include "ModelSelection.h"
+#include "Filter.h"
+#include "CostTable.h"
+#include "Pipeline.h"
+#include "Checksum.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Puts a model in the state every block starts from : a fresh model, or the
+// primed snapshot when one is given
+inline bool resetModel(Model& model, std::string const& snapshot, bool fresh = false){
+  if(snapshot.empty()){
+    if(!fresh) model.reset();
+    return true;
+  }
+  // The snapshot holds the full state, no need to reset first
+  SnapshotReader reader(snapshot);
+  return reader.good() && model.restore(reader);
+}
+
+// --- ArchiveWriter ---
+// Codes the concatenation of the entries of the header, block by block and
+// chunk by chunk, with the model the header asks for. A chunk the model does
+// not compress is stored instead, and the following chunks are stored without
+// running the model. The model is tried again every ProbeInterval chunks, or
+// as soon as a chunk looks compressible from its byte histogram.
+// The model runs on the calling thread and a coder thread does the rest : the
+// model hands its predictions over through a ring, the coder runs the Encoder
+// and writes the chunks. Whether to keep running the model is decided from
+// the cost the predictions announce, not from the coded size, so that the
+// model never waits for the coder. Without a coder thread, for inputs too
+// small to pay for starting one, the calling thread codes each chunk once
+// the model predicted it.
+// The checksums of the blocks and of the entries are taken as the data comes
+// in, before the dictionary and the filter.
+// The writer makes its model, or borrows one of the header type, which it
+// resets first.
+
+class ArchiveWriter {
+public:
+  static constexpr unsigned ProbeInterval = 16;
+
+  ArchiveWriter(std::ostream& stream, ArchiveHeader const& header, std::string const& snapshot, Model* model = nullptr,
+    bool threaded = true) :
+  mStream(stream), mHeader(header),
+  mOwnedModel(model ? nullptr : makeModel(static_cast<ModelType>(header.modelType), header.modelParameter)),
+  mModel(model ? model : mOwnedModel.get()),
+  mFilter(static_cast<FilterType>(header.filterType), header.filterParameter),
+  mSnapshot(snapshot), mDone(0), mStoring(false), mStoredRun(0), mBlocks(0), mClosed(false),
+  mThreaded(threaded), mJobs(16), mPredictions(1 << 16), mEntryEnd(0){
+    mGood = resetModel(*mModel, mSnapshot, !model);
+    if(!mHeader.entries.empty()){
+      mEntryEnd = mHeader.entries[0].size;
+      finishEntries();
+    }
+    mHeader.write(mStream);
+    mChunk.reserve(ArchiveHeader::ChunkSize);
+    // The stream belongs to the coder from now on
+    if(mThreaded) mCoder = std::thread(&ArchiveWriter::code, this);
+  }
+
+  ~ArchiveWriter(){
+    close();
+  }
+
+  bool good() const { return mGood; }
+
+  void write(char const* data, std::size_t size){
+    while(size > 0){
+      if(mChunk.empty() && (mDone == 0 || (mHeader.blockSize != 0 && mDone % mHeader.blockSize == 0))){
+        startBlock();
+      }
+      // Up to the end of the chunk, of the block or of the entry
+      std::uint64_t count = std::min<std::uint64_t>(size, ArchiveHeader::ChunkSize - mChunk.size());
+      if(mHeader.blockSize != 0) count = std::min(count, mHeader.blockSize - mDone % mHeader.blockSize);
+      if(mDone < mEntryEnd) count = std::min(count, mEntryEnd - mDone);
+      mBlockSum.update(data, count);
+      mEntrySum.update(data, count);
+      mChunk.insert(mChunk.end(), data, data + count);
+      mDone += count;
+      data += count;
+      size -= count;
+      finishEntries();
+      if(mChunk.size() == ArchiveHeader::ChunkSize || (mHeader.blockSize != 0 && mDone % mHeader.blockSize == 0)){
+        writeChunk();
+      }
+    }
+  }
+
+  // Writes the last chunk and the index
+  void close(){
+    if(mClosed) return;
+    mClosed = true;
+    writeChunk();
+    if(mThreaded){
+      mJobs.push(CoderJob{CoderJob::End, std::vector<char>()});
+      mCoder.join();
+    }
+    if(mBlocks != 0) mIndex.blockSums.push_back(mBlockSum.value());
+    // Entries the caller did not write all of keep the sum of what it wrote
+    while(mIndex.entrySums.size() < mHeader.entries.size()){
+      mIndex.entrySums.push_back(mEntrySum.value());
+      mEntrySum.reset();
+    }
+    mIndex.write(mStream);
+  }
+
+private:
+  // What the coder thread does next. The predictions of a Coded job follow in
+  // the predictions ring, eight per byte of data.
+  struct CoderJob {
+    enum Kind { Block, Coded, Stored, End } kind;
+    std::vector<char> data;
+  };
+
+  // Closes the checksums of the entries ending here, empty ones included
+  void finishEntries(){
+    while(mDone == mEntryEnd && mIndex.entrySums.size() < mHeader.entries.size()){
+      mIndex.entrySums.push_back(mEntrySum.value());
+      mEntrySum.reset();
+      if(mIndex.entrySums.size() < mHeader.entries.size()) mEntryEnd += mHeader.entries[mIndex.entrySums.size()].size;
+    }
+  }
+
+  void startBlock(){
+    if(mBlocks++ != 0){
+      mIndex.blockSums.push_back(mBlockSum.value());
+      mBlockSum.reset();
+      mGood = resetModel(*mModel, mSnapshot) && mGood;
+    }
+    send(CoderJob{CoderJob::Block, std::vector<char>()});
+  }
+
+  // To the coder thread, or coded right away
+  void send(CoderJob job){
+    if(mThreaded){
+      mJobs.push(std::move(job));
+    }else{
+      run(job);
+    }
+  }
+
+  void writeChunk(){
+    if(mChunk.empty()) return;
+    std::uint64_t position = mDone - mChunk.size();
+    if(!mHeader.dictionary.empty()){
+      mHeader.dictionary.encode((unsigned char const*) mChunk.data(), mChunk.size(), mWords);
+      mChunk.assign(mWords.begin(), mWords.end());
+    }
+    mFilter.encode((unsigned char*) mChunk.data(), mChunk.size(), position);
+    if(mStoring && mStoredRun % ProbeInterval != 0 && !looksCompressible()){
+      send(CoderJob{CoderJob::Stored, mChunk});
+    }else{
+      // The coder thread starts on the chunk while the model predicts it
+      if(mThreaded) mJobs.push(CoderJob{CoderJob::Coded, mChunk});
+      CostTable const& costs = CostTable::get();
+      std::uint64_t cost = 0;
+      std::array<std::uint32_t, 8> predictions;
+      for(char ch : mChunk){
+        unsigned char byte = ch;
+        mModel->predictByte(byte, predictions.data());
+        for(unsigned i = 0; i < 8; ++i){
+          cost += costs.cost(predictions[i], byte & (0x80 >> i)).value();
+        }
+        if(mThreaded){
+          mPredictions.write(predictions.data(), 8);
+        }else{
+          mChunkPredictions.insert(mChunkPredictions.end(), predictions.begin(), predictions.end());
+        }
+      }
+      if(!mThreaded){
+        run(CoderJob{CoderJob::Coded, mChunk});
+        mChunkPredictions.clear();
+      }
+      // Below 63/64 of the input the model is not worth its time, the coder
+      // adds its 8 bytes of flush to the cost
+      std::uint64_t out = (cost >> 23) + 9;
+      mStoring = 64 * out >= 63 * mChunk.size();
+      mStoredRun = 0;
+    }
+    if(mStoring) mStoredRun++;
+    mChunk.clear();
+  }
+
+  // Order 0 entropy of the chunk well below 8 bits per byte
+  bool looksCompressible() const {
+    std::array<std::uint32_t, 256> histogram{};
+    for(char ch : mChunk) histogram[static_cast<unsigned char>(ch)]++;
+    double entropy = 0.0;
+    for(std::uint32_t count : histogram){
+      if(count == 0) continue;
+      double p = static_cast<double>(count) / mChunk.size();
+      entropy -= p * std::log2(p);
+    }
+    return entropy < 7.5;
+  }
+
+  // --- Coder thread ---
+
+  void code(){
+    for(;;){
+      CoderJob job = mJobs.pop();
+      if(job.kind == CoderJob::End) return;
+      run(job);
+    }
+  }
+
+  // The predictions of a Coded job come from the ring, or from
+  // mChunkPredictions without a coder thread
+  void run(CoderJob const& job){
+    if(job.kind == CoderJob::Block){
+      mIndex.blockOffsets.push_back(mStream.tellp());
+    }else if(job.kind == CoderJob::Stored){
+      writeChunk(ChunkMode::Stored, job.data.data(), job.data.size(), job.data.size());
+    }else{
+      std::ostringstream coded;
+      {
+        Encoder encoder(coded);
+        for(std::size_t done = 0; done < job.data.size();){
+          std::size_t count = job.data.size() - done;
+          std::uint32_t const* predictions = mChunkPredictions.data() + 8 * done;
+          if(mThreaded){
+            count = std::min(count, mBatch.size() / 8);
+            mPredictions.read(mBatch.data(), 8 * count);
+            predictions = mBatch.data();
+          }
+          for(std::size_t c = 0; c < count; ++c){
+            unsigned char byte = job.data[done + c];
+            for(unsigned i = 0; i < 8; ++i){
+              encoder.encode(byte & (0x80 >> i), predictions[8 * c + i]);
+            }
+          }
+          done += count;
+        }
+      }
+      std::string const& out = coded.str();
+      if(out.size() < job.data.size()){
+        writeChunk(ChunkMode::Coded, out.data(), out.size(), job.data.size());
+      }else{
+        writeChunk(ChunkMode::StoredTrained, job.data.data(), job.data.size(), job.data.size());
+      }
+    }
+  }
+
+  void writeChunk(ChunkMode mode, char const* data, std::uint32_t size, std::uint32_t modelSize){
+    mStream.put(static_cast<char>(mode));
+    mStream.write((char const*) &size, sizeof(std::uint32_t));
+    if(!mHeader.dictionary.empty()){
+      mStream.write((char const*) &modelSize, sizeof(std::uint32_t));
+    }
+    mStream.write(data, size);
+  }
+
+  std::ostream& mStream;
+  ArchiveHeader mHeader;
+  ArchiveIndex mIndex;
+  std::unique_ptr<Model> mOwnedModel;
+  Model* mModel;
+  Filter mFilter;
+  std::string mSnapshot;
+  std::vector<char> mChunk;
+  std::vector<unsigned char> mWords;
+  std::uint64_t mDone;
+  bool mStoring;
+  unsigned mStoredRun;
+  std::uint64_t mBlocks;
+  bool mClosed, mGood;
+
+  // --- Model to coder ---
+  bool const mThreaded;
+  SPSCRing<CoderJob> mJobs;
+  SPSCRing<std::uint32_t> mPredictions;
+  std::thread mCoder;
+  std::vector<std::uint32_t> mBatch = std::vector<std::uint32_t>(8 * 4096); // The coder's
+  std::vector<std::uint32_t> mChunkPredictions;                             // Without a coder thread
+
+  // --- Checksums, the offsets are the coder's ---
+  Crc32c mBlockSum, mEntrySum;
+  std::uint64_t mEntryEnd;
+};
+
+// --- ArchiveReader ---
+// Decodes any range of the concatenation of the entries. Only the blocks
+// holding the range are decoded, and sequential reads never restart a block.
+// A block restored from its start to its end is checked against its
+// checksum, and a mismatch fails the read with corrupt() set. The entry
+// checksums are left to the caller, which sees the entry boundaries.
+// Like the writer, the reader may borrow a model of the header type.
+
+class ArchiveReader {
+public:
+  ArchiveReader(std::istream& stream, std::string const& snapshot, Model* model = nullptr) :
+  mStream(stream), mModel(model), mSnapshot(snapshot), mBlock(0), mPosition(0), mChunkLeft(0),
+  mBlockChecked(false), mFresh(!model), mStarted(false), mCorrupt(false){
+    mGood = mHeader.read(mStream) && mIndex.read(mStream)
+      && (!mIndex.blockOffsets.empty() || mHeader.totalSize() == 0)
+      && mIndex.entrySums.size() == mHeader.entries.size()
+      && validModelType(mHeader.modelType)
+      && mHeader.filterType <= static_cast<std::uint8_t>(FilterType::Split);
+    if(mGood){
+      if(!mModel){
+        mOwnedModel = makeModel(static_cast<ModelType>(mHeader.modelType), mHeader.modelParameter);
+        mModel = mOwnedModel.get();
+      }
+      mFilter = Filter(static_cast<FilterType>(mHeader.filterType), mHeader.filterParameter);
+    }
+  }
+
+  bool good() const { return mGood; }
+  ArchiveHeader const& header() const { return mHeader; }
+  ArchiveIndex const& index() const { return mIndex; }
+  // A read failed on a checksum
+  bool corrupt() const { return mCorrupt; }
+
+  // Decodes [offset, offset + size) into data
+  bool read(std::uint64_t offset, std::uint64_t size, char* data){
+    if(!mGood || offset + size > mHeader.totalSize()) return false;
+    while(size > 0){
+      std::uint64_t block = blockOf(offset);
+      if(block >= mIndex.blockOffsets.size()) return false;
+      if(!mStarted || block != mBlock || offset < mPosition){
+        if(!startBlock(block)) return false;
+      }
+      while(mPosition < offset){
+        if(!skip(offset - mPosition)) return false;
+      }
+      std::uint64_t end = blockEnd(block);
+      while(offset < end && size > 0){
+        std::uint64_t count = std::min(size, end - offset);
+        if(!copy(data, count)) return false;
+        data += count;
+        offset += count;
+        size -= count;
+      }
+    }
+    return true;
+  }
+
+private:
+  std::uint64_t blockOf(std::uint64_t offset) const {
+    return mHeader.blockSize == 0 ? 0 : offset / mHeader.blockSize;
+  }
+
+  std::uint64_t blockEnd(std::uint64_t block) const {
+    return mHeader.blockSize == 0 ? mHeader.totalSize() : std::min(mHeader.totalSize(), (block + 1) * mHeader.blockSize);
+  }
+
+  bool startBlock(std::uint64_t block){
+    if(!resetModel(*mModel, mSnapshot, mFresh)) return false;
+    mFresh = false;
+    mStarted = true;
+    mStream.clear();
+    mStream.seekg(mIndex.blockOffsets[block]);
+    mBlock = block;
+    mPosition = block * mHeader.blockSize;
+    mChunkLeft = 0;
+    mBlockSum.reset();
+    mBlockChecked = true;
+    return true;
+  }
+
+  std::uint64_t nextChunkLength() const {
+    return std::min<std::uint64_t>(ArchiveHeader::ChunkSize, blockEnd(mBlock) - mPosition);
+  }
+
+  // Reads and restores the next chunk, a stored chunk the model never saw is
+  // not even read when it is skipped
+  bool nextChunk(bool skipStored){
+    std::uint64_t length = nextChunkLength();
+    int mode = mStream.get();
+    std::uint32_t size = 0;
+    mStream.read((char*) &size, sizeof(std::uint32_t));
+    std::uint32_t modelSize = length;
+    if(!mHeader.dictionary.empty()){
+      mStream.read((char*) &modelSize, sizeof(std::uint32_t));
+    }
+    if(!mStream.good() || mode > static_cast<int>(ChunkMode::StoredTrained)) return false;
+    ChunkMode chunkMode = static_cast<ChunkMode>(mode);
+    // Replaced words take at least one byte, escapes two
+    if(modelSize > 2 * length || (chunkMode != ChunkMode::Coded && size != modelSize)) return false;
+    mChunkLeft = length;
+    mChunkPosition = 0;
+    if(skipStored && chunkMode == ChunkMode::Stored){
+      mBlockChecked = false;
+      mStream.seekg(size, std::ios::cur);
+      return mStream.good();
+    }
+
+    mChunkData.resize(size);
+    mStream.read(&mChunkData[0], size);
+    if(chunkMode == ChunkMode::Coded){
+      mCoded.str(mChunkData);
+      mCoded.clear();
+      Decoder decoder(mCoded);
+      mChunkData.resize(modelSize);
+      for(char& ch : mChunkData){
+        ch = mModel->decode(decoder);
+      }
+    }else if(chunkMode == ChunkMode::StoredTrained){
+      for(char ch : mChunkData){
+        mModel->learn(ch);
+      }
+    }
+    mFilter.decode((unsigned char*) &mChunkData[0], modelSize, mPosition);
+    if(!mHeader.dictionary.empty()){
+      if(!mHeader.dictionary.decode((unsigned char const*) mChunkData.data(), modelSize, mWords) || mWords.size() != length){
+        return false;
+      }
+      mChunkData.assign(mWords.begin(), mWords.end());
+    }
+    if(!mStream.good()) return false;
+    if(mBlockChecked){
+      mBlockSum.update(mChunkData.data(), length);
+      if(mPosition + length == blockEnd(mBlock) && mBlockSum.value() != mIndex.blockSums[mBlock]){
+        mCorrupt = true;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Moves forward by at most count bytes
+  bool skip(std::uint64_t count){
+    if(mChunkLeft == 0 && !nextChunk(count >= nextChunkLength())) return false;
+    std::uint64_t n = std::min(count, mChunkLeft);
+    mChunkPosition += n;
+    mChunkLeft -= n;
+    mPosition += n;
+    return true;
+  }
+
+  // Copies at most count bytes, up to the end of the chunk
+  bool copy(char* data, std::uint64_t& count){
+    if(mChunkLeft == 0 && !nextChunk(false)) return false;
+    count = std::min(count, mChunkLeft);
+    std::memcpy(data, mChunkData.data() + mChunkPosition, count);
+    mChunkPosition += count;
+    mChunkLeft -= count;
+    mPosition += count;
+    return true;
+  }
+
+  std::istream& mStream;
+  ArchiveHeader mHeader;
+  ArchiveIndex mIndex;
+  std::unique_ptr<Model> mOwnedModel;
+  Model* mModel;
+  std::string mSnapshot;
+  std::uint64_t mBlock, mPosition;
+
+  Filter mFilter;
+
+  // --- Current chunk, restored ---
+  std::string mChunkData;
+  std::vector<unsigned char> mWords;
+  std::uint64_t mChunkLeft, mChunkPosition;
+  std::istringstream mCoded;
+
+  // --- Checksum of the current block, so far ---
+  Crc32c mBlockSum;
+  bool mBlockChecked;
+
+  bool mFresh, mStarted, mGood, mCorrupt;
+};
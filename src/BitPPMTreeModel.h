@@ -0,0 +1,137 @@
+#pragma once
+#include "Model.h"
+
+
+// --- BitPPMTreeModel ---
+// The node tree BitPPMModel replaced, kept so that the k mode compares the
+// two on the same inputs. A node per context bit, allocated on first sight,
+// and O levels walked recursively for every count, increment and decrement.
+// Inner nodes count the older context bit rather than the coded one, and a
+// bit never seen after a context is predicted 0 or 1 outright.
+
+template<unsigned O>
+class BitPPMTreeModel : public Model {
+  using ContextType = std::array<bool, O>;
+  // ctx[0] is last read bit, ctx[O-1] is first read bit
+  // -- BitPPMModelTree --
+  class BitPPMModelTree {
+  public:
+    BitPPMModelTree(unsigned depth) :
+    mChildren{{nullptr, nullptr}},
+    mDepth(depth),
+    mCount{{0, 0}}{ }
+
+    BitPPMModelTree(BitPPMModelTree const& other) = delete;
+    BitPPMModelTree(BitPPMModelTree&& other) = delete;
+    BitPPMModelTree& operator=(BitPPMModelTree const& other) = delete;
+    BitPPMModelTree& operator=(BitPPMModelTree&& other) = delete;
+
+    ~BitPPMModelTree(){
+      clear();
+    }
+
+    void clear(){
+      for(BitPPMModelTree*& c : mChildren){
+        delete c;
+        c = nullptr;
+      }
+      mCount.fill(0);
+    }
+
+    BitPPMModelTree& child(bool b){
+      if(!mChildren[b]){
+        mChildren[b] = new BitPPMModelTree(mDepth + 1);
+      }
+      return *mChildren[b];
+    }
+
+    std::array<std::uint64_t, 2> contextCount(ContextType const& ctx){
+      if(mDepth == O){
+        return mCount;
+      } else {
+        std::array<std::uint64_t, 2> count = child(ctx[mDepth]).contextCount(ctx);
+        // Deeper contexts weigh 4/5, in integers to stay deterministic
+        count[0] = count[0] * 4 / 5 + mCount[0];
+        count[1] = count[1] * 4 / 5 + mCount[1];
+        return count;
+      }
+    }
+
+    void contextIncrement(ContextType const& ctx, bool nxt){
+      if(mDepth == O){
+        mCount[nxt] += 1;
+      } else {
+        child(ctx[mDepth]).contextIncrement(ctx, nxt);
+        mCount[ctx[mDepth]] += 1;
+      }
+    }
+
+    bool contextDecrement(ContextType const& ctx, bool nxt){
+      if(mDepth == O){
+        if(mCount[nxt] != 0){
+          mCount[nxt] -= 1;
+          return true;
+        }else{
+          return false;
+        }
+      } else {
+        if(child(ctx[mDepth]).contextDecrement(ctx, nxt)){
+          mCount[ctx[mDepth]] -= 1;
+        }
+        return false;
+      }
+    }
+
+  private:
+    std::array<BitPPMModelTree*, 2> mChildren;
+    unsigned mDepth;
+    std::array<std::uint64_t, 2> mCount;
+  };
+
+public:
+  BitPPMTreeModel(unsigned buffersize) :
+  mBuffer(buffersize),
+  mContextCount(0) {
+    assert(buffersize >= O + 1);
+  }
+
+  virtual std::uint32_t predict() override {
+    if(mBuffer.size() < O) return 1 << 31;
+    ContextType curContext;
+    for(unsigned i = 0; i < O; ++i){
+      curContext[i] = mBuffer[mBuffer.size() - i - 1];
+    }
+    std::array<std::uint64_t, 2> const& cCount = mContextCount.contextCount(curContext);
+    if(cCount[0] == 0 && cCount[1] == 0) return 1 << 31;
+    std::uint64_t dv = (static_cast<std::uint64_t>(cCount[1]) << 32) / (cCount[0] + cCount[1]);
+    // Neither bit may become impossible for the coder
+    return static_cast<std::uint32_t>(std::max<std::uint64_t>(1, std::min<std::uint64_t>(dv, 0xFFFFFFFF)));
+  }
+
+  virtual void reset() override {
+    mBuffer.clear();
+    mContextCount.clear();
+  }
+
+  virtual void update(bool b) override {
+    if(mBuffer.is_full()){
+      ContextType oldContext;
+      for(unsigned i = 0; i < O; ++i){
+        oldContext[O - i - 1] = mBuffer[i];
+      }
+      mContextCount.contextDecrement(oldContext, mBuffer[O]);
+    }
+    mBuffer.push_back(b);
+    if(mBuffer.size() >= O + 1){
+      ContextType newContext;
+      for(unsigned i = 0; i < O; ++i){
+        newContext[i] = mBuffer[mBuffer.size() - i - 2];
+      }
+      mContextCount.contextIncrement(newContext, b);
+    }
+  }
+
+private:
+  CircularBuffer<bool> mBuffer;
+  BitPPMModelTree mContextCount;
+};
@@ -1,44 +1,46 @@
 #pragma once
 #include "Model.h"
+#include "SquashTable.h"
 
 // --- Rna model ---
 
+// Layers have static shapes : the weights of all the layers are one aligned
+// block, the outputs, derivatives and deltas inline arrays, and predict and
+// update run fused kernels, without allocation nor indirect call.
 template<unsigned CtxSize, unsigned ...LS>
 class BitRNAModel : public Model {
-  static constexpr unsigned LayerCount = 1 + sizeof...(LS);
   static constexpr unsigned InContextSize = (1 << (CtxSize+1)) - 1;
-  static constexpr unsigned LayerSizes [] = { InContextSize, LS..., 1 };
+  using Shapes = LayerShapes<InContextSize, LS..., 1>;
+  static constexpr unsigned LayerCount = Shapes::Layers;
+  template<unsigned L> using LayerIndex = std::integral_constant<unsigned, L>;
+  template<unsigned L> using Shape = Layer<L, Shapes>;
+  using Last = Shape<LayerCount - 1>;
 public:
-  BitRNAModel() : 
+  static constexpr double DefaultRate = 0.3;
+
+  BitRNAModel(FixedPoint20 rate = FixedPoint20(DefaultRate)) :
   mBuffer(CtxSize),
-  random_generator(195486732)
+  random_generator(195486732),
+  mRate(rate)
   {
-    for(unsigned i = 0; i < LayerCount; ++i){
-      cacheResult[i].resize(1, LayerSizes[i+1]);
-      cacheDerivative[i].resize(1, LayerSizes[i+1]);
-    }
-    for(unsigned i = 0; i < LayerCount; ++i){
-      delta[i].resize(LayerSizes[i+1]);
-    }
+    initLayers();
+  }
 
-    std::uniform_real_distribution<double> distribution(-0.6, 0.6);
-    for(unsigned i = 0; i < LayerCount; ++i) {
-      layers[i].resize(LayerSizes[i], LayerSizes[i + 1]);
-      layers[i].init([&](unsigned, unsigned) -> FixedPoint20 {
-        return FixedPoint20(distribution(random_generator));
-      });
+  // Uniform in [-0.6, 0.6). minstd_rand is fully specified by the standard,
+  // unlike the distributions, so every build draws the same weights.
+  void initLayers(){
+    std::int32_t const range = FixedPoint20(0.6).value();
+    for(unsigned i = 0; i < mWeights.size(); ++i){
+      mWeights[i] = FixedPoint20::FromValue(static_cast<std::int32_t>(random_generator() % (2 * range)) - range);
     }
   }
 
   FixedPoint20 activation_function(FixedPoint20 const& x){
-    // std::cout << x.asDouble() << " " << (-x).asDouble() << " " << (-x).exp().asDouble() << " " << (FixedPoint20::Unit() / (FixedPoint20::Unit() + (-x).exp())).asDouble() << std::endl;
-    return FixedPoint20::Unit() / (FixedPoint20::Unit() + (-x).exp());
-  }
-  FixedPoint20 activation_derivative(FixedPoint20 const& x){
-    return activation_function(x) * (FixedPoint20::Unit() - activation_function(x));
+    return SquashTable::get().squash(x);
   }
 
-  void iterateOnContext(std::function<void(unsigned)> const& f){
+  template<typename F>
+  void iterateOnContext(F f){
     f(0);
     unsigned offset = 0;
     for(unsigned i = 0; i < mBuffer.size(); ++i){
@@ -51,67 +53,43 @@ public:
     // The input vector does not need to be computed
     /* The first vector can be computed faster than others as most in_vec components are zero */
     {
-      cacheResult[0].reset();
+      FixedPoint20 const* weights = mWeights.data();
+      FixedPoint20* result = mResult.data();
+      std::fill(result, result + Shape<0>::Out, FixedPoint20());
       iterateOnContext([&](unsigned i){
-        for(unsigned j = 0; j < LayerSizes[1]; ++j){
-          cacheResult[0].at(j, 0) += layers[0].at(j, i);
+        for(unsigned j = 0; j < Shape<0>::Out; ++j){
+          result[j] += weights[j * Shape<0>::In + i];
         }
       });
-      cacheDerivative[0].init([&](unsigned i, unsigned j) -> FixedPoint20 {
-        return activation_derivative(cacheResult[0].at(i, j));
-      });
-      cacheResult[0].apply([&](unsigned, unsigned, FixedPoint20 const& v) -> FixedPoint20 {
-        return activation_function(v);
-      });
-    }
-    for(unsigned i = 1; i < LayerCount; ++i){
-      auto tmp = layers[i] * cacheResult[i-1];
-      cacheResult[i].init([&](unsigned i, unsigned j) -> FixedPoint20 {
-        return activation_function(tmp.at(i, j));
-      });
-      cacheDerivative[i].init([&](unsigned i, unsigned j) -> FixedPoint20 {
-        return activation_derivative(tmp.at(i, j));
-      });
+      for(unsigned j = 0; j < Shape<0>::Out; ++j){
+        result[j] = activation_function(result[j]);
+        mDerivative[j] = SquashTable::derivative(result[j]);
+      }
     }
+    forward(LayerIndex<1>());
     // --- Get prediction
-    FixedPoint20 fp_prediction = cacheResult[LayerCount-1].at(0, 0);
+    FixedPoint20 fp_prediction = mResult[Last::UnitOffset];
     std::uint32_t prediction = fp_prediction.value() << 12;
     return prediction;
   }
 
   void train(bool b) {
-    FixedPoint20 training_rate = FixedPoint20(0.3);
-    // --- Create except vector ---
-    Matrix<FixedPoint20> except(1, 1, [&](unsigned, unsigned) -> FixedPoint20 { return b ? FixedPoint20::Unit() : FixedPoint20(); });
+    FixedPoint20 const training_rate = mRate;
+    FixedPoint20 const except = b ? FixedPoint20::Unit() : FixedPoint20();
 
     // --- First delta ---
-    for(int i = 0; i < 1; ++i){
-      delta[LayerCount - 1][i] = (cacheResult[LayerCount-1].at(i, 0) - except.at(i, 0)) * cacheDerivative[LayerCount-1].at(i, 0);
-    }
+    mDelta[Last::UnitOffset] = (mResult[Last::UnitOffset] - except) * mDerivative[Last::UnitOffset];
     // --- Backpropagation deltas ---
-    for(int l = LayerCount - 2; l >= 0; --l){
-      for(int i = 0; i < LayerSizes[l+1]; ++i){
-        delta[l][i] = 0;
-        for(int n = 0; n < LayerSizes[l+2]; ++n){
-          delta[l][i] += layers[l+1].at(n, i) * delta[l+1][n];
-        }
-        delta[l][i] *= cacheResult[l].at(i, 0);
-      }
-    }
+    backward(LayerIndex<LayerCount - 1>());
 
     // --- Only update needed values for the first layer
+    FixedPoint20* weights = mWeights.data();
     iterateOnContext([&](unsigned i){
-      for(int j = 0; j < layers[0].height(); ++j){
-        layers[0].at(j, i) -= training_rate * delta[0][j];
+      for(unsigned j = 0; j < Shape<0>::Out; ++j){
+        weights[j * Shape<0>::In + i] -= training_rate * mDelta[j];
       }
     });
-    for(int l = 1; l < LayerCount; ++l){
-      for(int i = 0; i < layers[l].height(); ++i){
-        for(int j = 0; j < layers[l].width(); ++j){
-          layers[l].at(i, j) -= training_rate * delta[l][i] * cacheDerivative[l-1].at(j, 0);
-        }
-      }
-    }
+    adjust(LayerIndex<1>(), training_rate);
   }
 
   virtual void update(bool b) override {
@@ -121,20 +99,98 @@ public:
     mBuffer.push_back(b);
   }
 
+  virtual void reset() override {
+    random_generator.seed(195486732);
+    initLayers();
+    mBuffer.clear();
+  }
+
+  // Each layer as a width, a height and its weights, like Matrix::save
+  virtual bool save(SnapshotWriter& writer) const override {
+    writer.section("BitRNAModel");
+    save(writer, LayerIndex<0>());
+    mBuffer.save(writer);
+    return writer.good();
+  }
+
+  virtual bool restore(SnapshotReader& reader) override {
+    return reader.section("BitRNAModel") && restore(reader, LayerIndex<0>()) && mBuffer.restore(reader);
+  }
+
 private:
-  Matrix<FixedPoint20> layers[LayerCount];
+  // --- Layer by layer, from L to the last one ---
+
+  // Outputs of layer L from the outputs of layer L - 1
+  template<unsigned L>
+  void forward(LayerIndex<L>){
+    using S = Shape<L>;
+    FixedPoint20* result = mResult.data() + S::UnitOffset;
+    FixedPoint20* derivative = mDerivative.data() + S::UnitOffset;
+    multiplyApply<S::Out, S::In>(mWeights.data() + S::WeightOffset, mResult.data() + Shape<L - 1>::UnitOffset, result,
+      [&](unsigned i, FixedPoint20 sum){
+        FixedPoint20 const s = activation_function(sum);
+        derivative[i] = SquashTable::derivative(s);
+        return s;
+      });
+  }
+  void forward(LayerIndex<LayerCount>){ }
+
+  // Deltas of layer L - 1 from the deltas of layer L
+  template<unsigned L>
+  void backward(LayerIndex<L>){
+    using S = Shape<L>;
+    FixedPoint20 const* previous = mResult.data() + Shape<L - 1>::UnitOffset;
+    multiplyTransposedApply<S::Out, S::In>(mWeights.data() + S::WeightOffset, mDelta.data() + S::UnitOffset,
+      mDelta.data() + Shape<L - 1>::UnitOffset, [&](unsigned j, FixedPoint20 sum){
+        return sum * previous[j];
+      });
+    backward(LayerIndex<L - 1>());
+  }
+  void backward(LayerIndex<0>){ }
+
+  template<unsigned L>
+  void adjust(LayerIndex<L>, FixedPoint20 rate){
+    using S = Shape<L>;
+    subtractOuter<S::Out, S::In>(mWeights.data() + S::WeightOffset, mDelta.data() + S::UnitOffset,
+      mDerivative.data() + Shape<L - 1>::UnitOffset, rate);
+    adjust(LayerIndex<L + 1>(), rate);
+  }
+  void adjust(LayerIndex<LayerCount>, FixedPoint20){ }
+
+  template<unsigned L>
+  void save(SnapshotWriter& writer, LayerIndex<L>) const {
+    using S = Shape<L>;
+    unsigned const w = S::In, h = S::Out;
+    writer.value(w);
+    writer.value(h);
+    writer.array(mWeights.data() + S::WeightOffset, S::In * S::Out);
+    save(writer, LayerIndex<L + 1>());
+  }
+  void save(SnapshotWriter&, LayerIndex<LayerCount>) const { }
+
+  template<unsigned L>
+  bool restore(SnapshotReader& reader, LayerIndex<L>){
+    using S = Shape<L>;
+    unsigned w = 0, h = 0;
+    reader.value(w);
+    reader.value(h);
+    return w == S::In && h == S::Out && reader.copyArray(mWeights.data() + S::WeightOffset, S::In * S::Out)
+      && restore(reader, LayerIndex<L + 1>());
+  }
+  bool restore(SnapshotReader&, LayerIndex<LayerCount>){ return true; }
+
+  AlignedArray<FixedPoint20, Shapes::Weights> mWeights;
   CircularBuffer<bool> mBuffer;
-  std::default_random_engine random_generator;
+  std::minstd_rand random_generator;
+  FixedPoint20 mRate;
 
-  // --- Training data ---
-  Matrix<FixedPoint20> cacheResult[LayerCount];
-  Matrix<FixedPoint20> cacheDerivative[LayerCount];
-  std::vector<FixedPoint20> delta[LayerCount];
+  // --- Training data, outputs of every layer ---
+  AlignedArray<FixedPoint20, Shapes::Units> mResult, mDerivative, mDelta;
 };
 
-template<unsigned CtxSize, unsigned ...LS>
-constexpr unsigned BitRNAModel<CtxSize, LS...>::LayerCount;
 template<unsigned CtxSize, unsigned ...LS>
 constexpr unsigned BitRNAModel<CtxSize, LS...>::InContextSize;
 template<unsigned CtxSize, unsigned ...LS>
-constexpr unsigned BitRNAModel<CtxSize, LS...>::LayerSizes [];
\ No newline at end of file
+constexpr unsigned BitRNAModel<CtxSize, LS...>::LayerCount;
+template<unsigned CtxSize, unsigned ...LS>
+constexpr double BitRNAModel<CtxSize, LS...>::DefaultRate;
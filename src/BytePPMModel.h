@@ -23,6 +23,18 @@ class BytePPMModel : public Model {
     BytePPMModelTree& operator=(BytePPMModelTree const& other) = delete;
     BytePPMModelTree& operator=(BytePPMModelTree&& other) = delete;
 
+    ~BytePPMModelTree(){
+      clear();
+    }
+
+    void clear(){
+      for(BytePPMModelTree*& c : mChildren){
+        delete c;
+        c = nullptr;
+      }
+      mCount.fill(0);
+    }
+
     BytePPMModelTree& child(unsigned char b){
       if(!mChildren[b]){
         mChildren[b] = new BytePPMModelTree(mDepth + 1);
@@ -30,13 +42,14 @@ class BytePPMModel : public Model {
       return *mChildren[b];
     }
 
-    std::array<std::uint64_t, 256> contextCount(ContextType const& ctx){
+    // Counts of the deeper contexts grow by growth at each level
+    std::array<std::uint64_t, 256> contextCount(ContextType const& ctx, Ratio growth){
       if(mDepth == O){
         return mCount;
       } else {
-        std::array<std::uint64_t, 256> count = child(ctx[mDepth]).contextCount(ctx);
+        std::array<std::uint64_t, 256> count = child(ctx[mDepth]).contextCount(ctx, growth);
         for(unsigned i = 0; i < 256; ++i){
-          count[i] = 3 * count[i] / 2 + mCount[i];
+          count[i] = growth.apply(count[i]) + mCount[i];
         }
         return count;
       }
@@ -74,10 +87,11 @@ class BytePPMModel : public Model {
   };
 
 public:
-  BytePPMModel(unsigned buffersize) :
+  BytePPMModel(unsigned buffersize, Ratio growth = Ratio{3, 2}) :
   mBuffer(buffersize),
-  mContextCount(0) {
-    assert(buffersize >= O + 1);
+  mContextCount(0),
+  mGrowth(growth) {
+    assert(buffersize >= O + 1 && growth.denominator != 0);
     mCurBit = 1 << 7;
     mCurChar = 0;
   }
@@ -88,7 +102,7 @@ public:
       for(unsigned i = 0; i < O; ++i){
         curContext[i] = mBuffer[mBuffer.size() - i - 1];
       }
-      std::array<std::uint64_t, 256> const& cCount = mContextCount.contextCount(curContext);
+      std::array<std::uint64_t, 256> const& cCount = mContextCount.contextCount(curContext, mGrowth);
 
       std::uint64_t c1 = 0;
       std::uint64_t c0 = 0;
@@ -116,7 +130,8 @@ public:
         // ---
         // std::cout << c0 << " " << c1 << " " << dv << "\n";
         // ---
-        return (c0 == 0 ? (1ull << 32) - 1 : static_cast<std::uint32_t>(dv));
+        // Neither bit may become impossible for the coder
+        return static_cast<std::uint32_t>(std::max<std::uint64_t>(1, std::min<std::uint64_t>(dv, 0xFFFFFFFF)));
       }
     }else{
       // std::cout << "No context !" << std::endl;
@@ -124,6 +139,13 @@ public:
     }
   }
 
+  virtual void reset() override {
+    mBuffer.clear();
+    mContextCount.clear();
+    mCurBit = 1 << 7;
+    mCurChar = 0;
+  }
+
   virtual void update(bool b) override {
     if(b){ 
       mCurChar += mCurBit;
@@ -157,4 +179,5 @@ private:
   unsigned char mCurChar;
   unsigned mCurBit;
   BytePPMModelTree mContextCount;
+  Ratio mGrowth;
 };
\ No newline at end of file
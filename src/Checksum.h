@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <cinttypes>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// --- Crc32c ---
+// CRC32C (Castagnoli) of a stream of bytes, fed in pieces. On x86-64 the
+// SSE4.2 crc32 instruction does the work, 8 bytes per instruction, when the
+// processor has it, otherwise a slicing by 8 table. Both give the same value,
+// crc32c("123456789") = 0xe3069283.
+
+class Crc32c {
+public:
+  Crc32c() : mState(~0u){ }
+
+  static std::uint32_t of(void const* data, std::size_t size){
+    Crc32c crc;
+    crc.update(data, size);
+    return crc.value();
+  }
+
+  void update(void const* data, std::size_t size){
+    unsigned char const* bytes = static_cast<unsigned char const*>(data);
+#if defined(__x86_64__)
+    if(hardware()){
+      mState = updateHardware(mState, bytes, size);
+      return;
+    }
+#endif
+    mState = updateTable(mState, bytes, size);
+  }
+
+  std::uint32_t value() const { return ~mState; }
+  void reset(){ mState = ~0u; }
+
+private:
+  using Tables = std::array<std::array<std::uint32_t, 256>, 8>;
+
+  // tables[k][b] is the crc of byte b followed by k zero bytes
+  static Tables const& tables(){
+    static Tables const t = [](){
+      Tables t;
+      for(std::uint32_t b = 0; b < 256; ++b){
+        std::uint32_t crc = b;
+        for(unsigned i = 0; i < 8; ++i){
+          crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1)));
+        }
+        t[0][b] = crc;
+      }
+      for(std::uint32_t b = 0; b < 256; ++b){
+        for(unsigned k = 1; k < 8; ++k){
+          t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xff];
+        }
+      }
+      return t;
+    }();
+    return t;
+  }
+
+  static std::uint32_t updateTable(std::uint32_t crc, unsigned char const* data, std::size_t size){
+    Tables const& t = tables();
+    for(; size >= 8; data += 8, size -= 8){
+      std::uint32_t low, high;
+      std::memcpy(&low, data, 4);
+      std::memcpy(&high, data + 4, 4);
+      low ^= crc;
+      crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24]
+        ^ t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+    }
+    for(; size > 0; ++data, --size){
+      crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xff];
+    }
+    return crc;
+  }
+
+#if defined(__x86_64__)
+  static bool hardware(){
+    static bool const supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+  }
+
+  __attribute__((target("sse4.2")))
+  static std::uint32_t updateHardware(std::uint32_t crc, unsigned char const* data, std::size_t size){
+    std::uint64_t state = crc;
+    for(; size >= 8; data += 8, size -= 8){
+      std::uint64_t word;
+      std::memcpy(&word, data, 8);
+      state = _mm_crc32_u64(state, word);
+    }
+    crc = static_cast<std::uint32_t>(state);
+    for(; size > 0; ++data, --size){
+      crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+  }
+#endif
+
+  std::uint32_t mState;
+};
@@ -1,34 +1,52 @@
 #pragma once
 
 #include <cassert>
+#include <cinttypes>
 #include <vector>
+#include <algorithm>
 #include <type_traits>
 
+#include "Snapshot.h"
+
+// --- CircularBuffer ---
+// The last values pushed, at most capacity of them. The storage is a power of
+// two, so that indexing is a mask rather than a division, and it is mirrored :
+// every value is written twice, one storage size apart, so that the last n
+// values are always contiguous, see window(). Slots never written read as T().
+
+inline unsigned circularStorage(unsigned capacity){
+  unsigned storage = 1;
+  while(storage < capacity) storage <<= 1;
+  return storage;
+}
+
 template<typename T>
 class CircularBuffer{
   static_assert(std::is_literal_type<T>::value, "");
 public:
-  CircularBuffer(unsigned size) : mData(size), mFront(0), mCurrentSize(0){ }
+  CircularBuffer(unsigned capacity) :
+  mCapacity(capacity), mMask(circularStorage(capacity) - 1), mData(2 * (mMask + 1)), mFront(0), mCurrentSize(0){ }
 
   unsigned size() const { return mCurrentSize; }
+  unsigned capacity() const { return mCapacity; }
 
   bool is_empty() const { return mCurrentSize == 0; }
-  bool is_full() const { return mCurrentSize == mData.size(); }
+  bool is_full() const { return mCurrentSize == mCapacity; }
 
   T const& front() const {
     return mData[mFront];
   }
 
   T const& back() const {
-    return mData[(mFront + mCurrentSize - 1) % mData.size()];
+    return mData[(mFront + mCurrentSize - 1) & mMask];
   }
 
   void push_back(T const& val){
-    if(mCurrentSize == mData.size()){
+    if(mCurrentSize == mCapacity){
       pop_front();
     }
+    set((mFront + mCurrentSize) & mMask, val);
     mCurrentSize = mCurrentSize + 1;
-    mData[(mFront + mCurrentSize - 1) % mData.size()] = val;
   }
   void pop_back(){
     assert(mCurrentSize != 0);
@@ -36,23 +54,149 @@ public:
   }
 
   void push_front(T const& val){
-    mCurrentSize = std::min<unsigned>(mCurrentSize + 1, mData.size());
-    if(mFront == 0){ mFront = mData.size() - 1; }
-    else{ mFront -= 1; }
-    mData[mFront] = val;
+    mCurrentSize = std::min<unsigned>(mCurrentSize + 1, mCapacity);
+    mFront = (mFront - 1) & mMask;
+    set(mFront, val);
   }
   void pop_front(){
     assert(mCurrentSize != 0);
-    mFront += 1; if(mFront == mData.size()){ mFront = 0; }
+    mFront = (mFront + 1) & mMask;
     mCurrentSize -= 1;
   }
 
+  void clear(){
+    std::fill(mData.begin(), mData.end(), T());
+    mFront = 0;
+    mCurrentSize = 0;
+  }
+
   T operator[](unsigned i) const{
-    return mData[(mFront + i) % mData.size()];
+    return mData[(mFront + i) & mMask];
+  }
+
+  // The last n values, oldest first, without wraparound. Before n values were
+  // pushed the first ones read as T().
+  T const* window(unsigned n) const {
+    assert(n <= mCapacity);
+    return &mData[(mFront + mCurrentSize - n) & mMask];
+  }
+
+  // Oldest first, whatever the storage layout
+  void save(SnapshotWriter& writer) const {
+    writer.value(mCurrentSize);
+    for(unsigned i = 0; i < mCurrentSize; ++i){
+      writer.value((*this)[i]);
+    }
+  }
+
+  bool restore(SnapshotReader& reader){
+    unsigned size = 0;
+    reader.value(size);
+    if(!reader.good() || size > mCapacity) return false;
+    clear();
+    for(unsigned i = 0; i < size; ++i){
+      T v = T();
+      reader.value(v);
+      push_back(v);
+    }
+    return reader.good();
   }
 
 private:
+  void set(unsigned i, T const& val){
+    mData[i] = val;
+    mData[i + mMask + 1] = val;
+  }
+
+  unsigned mCapacity, mMask;
   std::vector<T> mData;
   unsigned mFront;
   unsigned mCurrentSize;
 };
+
+// --- CircularBuffer of bits ---
+// Bit histories, packed 64 to a word with the same masked indexing. No window,
+// bits are not addressable.
+
+template<>
+class CircularBuffer<bool>{
+public:
+  CircularBuffer(unsigned capacity) :
+  mCapacity(capacity), mMask(std::max(circularStorage(capacity), 64u) - 1), mData((mMask + 1) / 64), mFront(0), mCurrentSize(0){ }
+
+  unsigned size() const { return mCurrentSize; }
+  unsigned capacity() const { return mCapacity; }
+
+  bool is_empty() const { return mCurrentSize == 0; }
+  bool is_full() const { return mCurrentSize == mCapacity; }
+
+  bool front() const { return get(mFront); }
+  bool back() const { return get((mFront + mCurrentSize - 1) & mMask); }
+
+  void push_back(bool val){
+    if(mCurrentSize == mCapacity){
+      pop_front();
+    }
+    set((mFront + mCurrentSize) & mMask, val);
+    mCurrentSize = mCurrentSize + 1;
+  }
+  void pop_back(){
+    assert(mCurrentSize != 0);
+    mCurrentSize -= 1;
+  }
+
+  void push_front(bool val){
+    mCurrentSize = std::min<unsigned>(mCurrentSize + 1, mCapacity);
+    mFront = (mFront - 1) & mMask;
+    set(mFront, val);
+  }
+  void pop_front(){
+    assert(mCurrentSize != 0);
+    mFront = (mFront + 1) & mMask;
+    mCurrentSize -= 1;
+  }
+
+  void clear(){
+    std::fill(mData.begin(), mData.end(), 0);
+    mFront = 0;
+    mCurrentSize = 0;
+  }
+
+  bool operator[](unsigned i) const{
+    return get((mFront + i) & mMask);
+  }
+
+  void save(SnapshotWriter& writer) const {
+    writer.value(mCurrentSize);
+    for(unsigned i = 0; i < mCurrentSize; ++i){
+      writer.value((*this)[i]);
+    }
+  }
+
+  bool restore(SnapshotReader& reader){
+    unsigned size = 0;
+    reader.value(size);
+    if(!reader.good() || size > mCapacity) return false;
+    clear();
+    for(unsigned i = 0; i < size; ++i){
+      bool v = false;
+      reader.value(v);
+      push_back(v);
+    }
+    return reader.good();
+  }
+
+private:
+  bool get(unsigned i) const {
+    return (mData[i >> 6] >> (i & 63)) & 1;
+  }
+  void set(unsigned i, bool val){
+    std::uint64_t bit = std::uint64_t(1) << (i & 63);
+    mData[i >> 6] = val ? (mData[i >> 6] | bit) : (mData[i >> 6] & ~bit);
+  }
+
+  unsigned mCapacity, mMask;
+  std::vector<std::uint64_t> mData;
+  unsigned mFront;
+  unsigned mCurrentSize;
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "Archive.h"
+#include "Archiver.h"
+#include "ModelSelection.h"
+
+#include <cinttypes>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+// --- MemoryStreamBuffer ---
+// Stream buffer over caller memory, read or written in place. Writing past
+// the end fails the stream instead of growing it.
+
+class MemoryStreamBuffer : public std::streambuf {
+public:
+  MemoryStreamBuffer(char* data, std::size_t size){
+    setp(data, data + size);
+    setg(data, data, data + size);
+  }
+
+  // Read only memory, never written through
+  MemoryStreamBuffer(char const* data, std::size_t size) : MemoryStreamBuffer(const_cast<char*>(data), size){
+    setp(nullptr, nullptr);
+  }
+
+  std::size_t written() const { return pptr() - pbase(); }
+
+protected:
+  virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+    if(which & std::ios_base::out){
+      // Only tellp
+      return off == 0 && dir == std::ios_base::cur ? pos_type(written()) : pos_type(off_type(-1));
+    }
+    off_type size = egptr() - eback();
+    off_type position = off + (dir == std::ios_base::beg ? 0 : dir == std::ios_base::cur ? gptr() - eback() : size);
+    if(position < 0 || position > size) return pos_type(off_type(-1));
+    setg(eback(), eback() + position, egptr());
+    return pos_type(position);
+  }
+
+  virtual pos_type seekpos(pos_type position, std::ios_base::openmode which) override {
+    return seekoff(off_type(position), std::ios_base::beg, which);
+  }
+};
+
+// --- Compressor ---
+// In process compression of buffers, in the archive format with a single
+// unnamed entry. A compressor keeps its model from one call to the next and
+// resets it in place, so that a call costs the pages the model touches
+// rather than a new table. Decompressing an archive of another model type
+// replaces the model. Buffers of up to InlineSize bytes are coded on the
+// calling thread, larger ones with a coder thread for the call. Not thread
+// safe, use one compressor per thread.
+
+class Compressor {
+public:
+  enum class Status {
+    Ok,
+    OutputTooSmall,
+    Corrupt
+  };
+
+  // A single chunk : a coder thread would only overlap the model with the
+  // coding of that chunk, for the price of starting the thread
+  static constexpr std::size_t InlineSize = ArchiveHeader::ChunkSize;
+
+  Compressor(ModelType type = ModelType::Small, std::uint32_t parameter = 0) :
+  mType(type), mParameter(parameter){ }
+
+  // Largest compressed size of size bytes : chunks the model does not
+  // compress are stored, with their chunk header, plus the header and the
+  // index of a single block and entry
+  static std::size_t bound(std::size_t size){
+    return size + 9 * (size / ArchiveHeader::ChunkSize + 1) + 96;
+  }
+
+  // Decompressed size of a compressed buffer
+  static bool contentSize(char const* data, std::size_t size, std::uint64_t& result){
+    MemoryStreamBuffer buffer(data, size);
+    std::istream stream(&buffer);
+    ArchiveHeader header;
+    if(!header.read(stream)) return false;
+    result = header.totalSize();
+    return true;
+  }
+
+  Status compress(char const* data, std::size_t size, char* out, std::size_t capacity, std::size_t& outSize){
+    ArchiveHeader header;
+    header.modelType = static_cast<std::uint8_t>(mType);
+    header.modelParameter = mParameter;
+    header.entries.push_back(ArchiveEntry{ std::string(), size });
+    MemoryStreamBuffer buffer(out, capacity);
+    std::ostream stream(&buffer);
+    {
+      ArchiveWriter writer(stream, header, std::string(), &model(mType, mParameter), size > InlineSize);
+      writer.write(data, size);
+    }
+    outSize = buffer.written();
+    return stream.good() ? Status::Ok : Status::OutputTooSmall;
+  }
+
+  Status decompress(char const* data, std::size_t size, char* out, std::size_t capacity, std::size_t& outSize){
+    MemoryStreamBuffer buffer(data, size);
+    std::istream stream(&buffer);
+    ArchiveHeader header;
+    if(!header.read(stream) || !validModelType(header.modelType)) return Status::Corrupt;
+    if(header.totalSize() > capacity) return Status::OutputTooSmall;
+    stream.clear();
+    stream.seekg(0);
+    ArchiveReader reader(stream, std::string(), &model(static_cast<ModelType>(header.modelType), header.modelParameter));
+    if(!reader.good() || !reader.read(0, header.totalSize(), out)) return Status::Corrupt;
+    outSize = header.totalSize();
+    return Status::Ok;
+  }
+
+  // Resets the model now, giving its pages back to the system, rather than
+  // on the next call
+  void reset(){
+    if(mModel) mModel->reset();
+  }
+
+private:
+  Model& model(ModelType type, std::uint32_t parameter){
+    if(!mModel || type != mModelType || parameter != mModelParameter){
+      mModel.reset();
+      mModel = makeModel(type, parameter);
+      mModelType = type;
+      mModelParameter = parameter;
+    }
+    return *mModel;
+  }
+
+  ModelType mType;
+  std::uint32_t mParameter;
+
+  std::unique_ptr<Model> mModel;
+  ModelType mModelType = ModelType::Flat;
+  std::uint32_t mModelParameter = 0;
+};
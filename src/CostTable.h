@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cinttypes>
+#include <array>
+
+#include "FixedPoint.h"
+
+// --- CostTable ---
+// Cost in bits of coding a bit, -log2(p), for the 32 bits predictions used by
+// the models and the coder. Entries are FixedPoint20 computed once with the
+// fixed point logarithm, so no floating point is involved per bit.
+
+class CostTable {
+public:
+  static constexpr unsigned Bits = 12;
+
+  static CostTable const& get(){
+    static CostTable const table;
+    return table;
+  }
+
+  // pred is the probability that the bit is a one
+  FixedPoint20 cost(std::uint32_t pred, bool bit) const {
+    return mCost[(bit ? pred : ~pred) >> (32 - Bits)];
+  }
+
+private:
+  CostTable(){
+    FixedPoint24 const invLn2 = FixedPoint24(1.4426950408889634);
+    for(unsigned i = 0; i < (1u << Bits); ++i){
+      // Middle of the bucket, as a 8 - 24 FixedPoint
+      FixedPoint24 p = FixedPoint24::FromValue((i << (24 - Bits)) + (1 << (23 - Bits)));
+      mCost[i] = FixedPoint20::FromValue((-p.subOneLn() * invLn2).value() >> 4);
+    }
+  }
+
+  std::array<FixedPoint20, 1 << Bits> mCost;
+};
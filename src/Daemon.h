@@ -0,0 +1,462 @@
+#pragma once
+
+#include "Archive.h"
+#include "Compressor.h"
+#include "ModelSelection.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// --- Daemon protocol ---
+// Requests and replies over a Unix domain socket, any number of them per
+// connection, integers little-endian :
+//   request : uint8 command, uint8 model type, uint32 model parameter,
+//             uint64 size, size bytes
+//   reply   : uint8 status, uint64 size, size bytes
+// Compress uses the model of the request, decompress the model of the
+// archive. Stats replies text and Stop stops the daemon, both ignore the
+// model and send no bytes.
+
+enum class DaemonCommand : std::uint8_t {
+  Compress,
+  Decompress,
+  Stats,
+  Stop
+};
+
+enum class DaemonStatus : std::uint8_t {
+  Ok,
+  Corrupt,    // Not an archive, or a damaged one
+  TooLarge,   // Over MaxRequest, or a model over the whole memory budget
+  BadRequest
+};
+
+static constexpr std::uint64_t MaxRequest = std::uint64_t(1) << 30;
+
+inline bool readFully(int fd, void* data, std::size_t size){
+  char* p = static_cast<char*>(data);
+  while(size > 0){
+    ssize_t n = ::read(fd, p, size);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+inline bool writeFully(int fd, void const* data, std::size_t size){
+  char const* p = static_cast<char const*>(data);
+  while(size > 0){
+    ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+inline bool sendRequest(int fd, DaemonCommand command, ModelType type, std::uint32_t parameter, char const* data, std::uint64_t size){
+  std::array<char, 14> header;
+  header[0] = static_cast<char>(command);
+  header[1] = static_cast<char>(type);
+  std::memcpy(&header[2], &parameter, sizeof(std::uint32_t));
+  std::memcpy(&header[6], &size, sizeof(std::uint64_t));
+  return writeFully(fd, header.data(), header.size()) && writeFully(fd, data, size);
+}
+
+inline bool receiveReply(int fd, DaemonStatus& status, std::vector<char>& data){
+  std::array<char, 9> header;
+  if(!readFully(fd, header.data(), header.size())) return false;
+  std::uint64_t size = 0;
+  std::memcpy(&size, &header[1], sizeof(std::uint64_t));
+  status = static_cast<DaemonStatus>(header[0]);
+  if(size > MaxRequest + Compressor::bound(MaxRequest)) return false;
+  data.resize(size);
+  return readFully(fd, data.data(), size);
+}
+
+// Connected socket, -1 on failure
+inline int connectDaemon(std::string const& path){
+  sockaddr_un address{};
+  if(path.size() >= sizeof(address.sun_path)) return -1;
+  address.sun_family = AF_UNIX;
+  std::strcpy(address.sun_path, path.c_str());
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0) return -1;
+  if(::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0){
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// --- ModelPool ---
+// Compressors kept warm between requests, with at most budget bytes of model
+// weights at once. A request for a model no idle compressor has gets a new
+// one when the budget allows, after dropping idle compressors of other
+// models if needed, and otherwise waits for a compressor to come back.
+
+class ModelPool {
+public:
+  ModelPool(std::uint64_t budget) : mBudget(budget), mUsed(0), mCreated(0), mDropped(0), mWaits(0){ }
+
+  // Compressors of the model ahead of the first request, as many as fit
+  void warm(ModelType type, std::uint32_t parameter, unsigned count){
+    std::vector<std::unique_ptr<Compressor>> warm;
+    for(unsigned i = 0; i < count; ++i){
+      std::unique_ptr<Compressor> compressor = acquire(type, parameter, false);
+      if(!compressor) break;
+      // Allocates the model and the shared tables
+      std::vector<char> out(Compressor::bound(1));
+      std::size_t size = 0;
+      compressor->compress("", 1, out.data(), out.size(), size);
+      warm.push_back(std::move(compressor));
+    }
+    for(std::unique_ptr<Compressor>& compressor : warm){
+      release(type, parameter, std::move(compressor));
+    }
+  }
+
+  // nullptr when the model alone is over the budget, or when it does not
+  // fit and wait is false
+  std::unique_ptr<Compressor> acquire(ModelType type, std::uint32_t parameter, bool wait = true){
+    std::uint64_t cost = memory(type);
+    std::unique_lock<std::mutex> lock(mMutex);
+    if(cost > mBudget) return nullptr;
+    bool waited = false;
+    for(;;){
+      for(auto it = mIdle.begin(); it != mIdle.end(); ++it){
+        if(it->type == type && it->parameter == parameter){
+          std::unique_ptr<Compressor> compressor = std::move(it->compressor);
+          mIdle.erase(it);
+          return compressor;
+        }
+      }
+      // Least recently used first
+      while(mUsed + cost > mBudget && !mIdle.empty()){
+        mUsed -= memory(mIdle.front().type);
+        mIdle.pop_front();
+        mDropped++;
+      }
+      if(mUsed + cost <= mBudget){
+        mUsed += cost;
+        mCreated++;
+        return std::unique_ptr<Compressor>(new Compressor(type, parameter));
+      }
+      if(!wait) return nullptr;
+      if(!waited) mWaits++;
+      waited = true;
+      mReleased.wait(lock);
+    }
+  }
+
+  void release(ModelType type, std::uint32_t parameter, std::unique_ptr<Compressor> compressor){
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mIdle.push_back(Idle{ type, parameter, std::move(compressor) });
+    }
+    mReleased.notify_all();
+  }
+
+  std::string report() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::ostringstream out;
+    out << "pool : budget " << (mBudget >> 20) << " MB, used " << (mUsed >> 20) << " MB, idle " << mIdle.size()
+      << ", created " << mCreated << ", dropped " << mDropped << ", waits " << mWaits << "\n";
+    return out.str();
+  }
+
+private:
+  // Weights, plus the chunk buffers every compressor has
+  static std::uint64_t memory(ModelType type){
+    return modelMemory(type) + (1 << 20);
+  }
+
+  struct Idle {
+    ModelType type;
+    std::uint32_t parameter;
+    std::unique_ptr<Compressor> compressor;
+  };
+
+  mutable std::mutex mMutex;
+  std::condition_variable mReleased;
+  std::deque<Idle> mIdle;
+  std::uint64_t mBudget, mUsed;
+  std::uint64_t mCreated, mDropped, mWaits;
+};
+
+// --- LatencyStats ---
+// Service time of the last Window requests of each command, from the end of
+// the request to the end of the reply, with totals since the start.
+
+class LatencyStats {
+public:
+  static constexpr unsigned Window = 4096;
+
+  void record(DaemonCommand command, double seconds, std::uint64_t in, std::uint64_t out){
+    std::lock_guard<std::mutex> lock(mMutex);
+    Command& c = mCommands[static_cast<unsigned>(command)];
+    if(c.latencies.size() < Window){
+      c.latencies.push_back(seconds);
+    }else{
+      c.latencies[c.count % Window] = seconds;
+    }
+    c.count++;
+    c.in += in;
+    c.out += out;
+  }
+
+  std::string report() const {
+    static char const* const names[] = { "compress", "decompress", "stats", "stop" };
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::ostringstream out;
+    for(unsigned i = 0; i < 2; ++i){
+      Command const& c = mCommands[i];
+      out << names[i] << " : " << c.count << " requests, " << c.in << " bytes in, " << c.out << " bytes out";
+      if(!c.latencies.empty()){
+        std::vector<double> sorted = c.latencies;
+        std::sort(sorted.begin(), sorted.end());
+        auto percentile = [&](double p){
+          return 1000.0 * sorted[std::min<std::size_t>(sorted.size() - 1, p * sorted.size())];
+        };
+        out << ", ms p50 " << percentile(0.5) << " p90 " << percentile(0.9) << " p99 " << percentile(0.99)
+          << " max " << 1000.0 * sorted.back();
+      }
+      out << "\n";
+    }
+    return out.str();
+  }
+
+private:
+  struct Command {
+    std::vector<double> latencies;
+    std::uint64_t count = 0, in = 0, out = 0;
+  };
+
+  mutable std::mutex mMutex;
+  std::array<Command, 4> mCommands;
+};
+
+// --- Daemon ---
+// Serves the requests on a Unix domain socket with a fixed set of worker
+// threads, each one serving a connection until the client closes it, so that
+// at most workers connections are served at once and the others wait. A
+// socket left at the path by a previous daemon is replaced, any other file
+// is left alone and the daemon does not start.
+
+class Daemon {
+public:
+  Daemon(std::string const& path, ModelPool& pool, unsigned workers) :
+  mPath(path), mPool(pool), mWorkers(std::max(workers, 1u)), mListen(-1), mStopping(false){
+    sockaddr_un address{};
+    if(path.size() >= sizeof(address.sun_path)){
+      mError = "path too long";
+      return;
+    }
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path.c_str());
+    struct stat status;
+    if(::lstat(path.c_str(), &status) == 0){
+      if(!S_ISSOCK(status.st_mode)){
+        mError = "not a socket, left in place";
+        return;
+      }
+      ::unlink(path.c_str());
+    }
+    mListen = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(mListen < 0 || ::bind(mListen, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+      || ::listen(mListen, 64) != 0){
+      mError = std::strerror(errno);
+      if(mListen >= 0) ::close(mListen);
+      mListen = -1;
+    }
+  }
+
+  ~Daemon(){
+    if(mListen >= 0){
+      ::close(mListen);
+      ::unlink(mPath.c_str());
+    }
+  }
+
+  bool good() const { return mListen >= 0; }
+  // Why the daemon is not good
+  std::string const& error() const { return mError; }
+
+  // Until a Stop request
+  void run(){
+    std::vector<std::thread> workers;
+    for(unsigned i = 0; i < mWorkers; ++i){
+      workers.emplace_back(&Daemon::work, this);
+    }
+    for(;;){
+      int fd = ::accept(mListen, nullptr, nullptr);
+      if(fd < 0){
+        if(errno == EINTR || errno == ECONNABORTED) continue;
+        break;
+      }
+      std::lock_guard<std::mutex> lock(mMutex);
+      if(mStopping){
+        ::close(fd);
+        break;
+      }
+      mPending.push_back(fd);
+      mWork.notify_one();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStopping = true;
+      for(int fd : mPending) ::close(fd);
+      mPending.clear();
+    }
+    mWork.notify_all();
+    for(std::thread& worker : workers) worker.join();
+  }
+
+private:
+  void work(){
+    for(;;){
+      int fd = -1;
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWork.wait(lock, [&](){ return mStopping || !mPending.empty(); });
+        if(mStopping) return;
+        fd = mPending.front();
+        mPending.pop_front();
+        mActive.insert(fd);
+      }
+      serve(fd);
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mActive.erase(fd);
+      }
+      ::close(fd);
+    }
+  }
+
+  void serve(int fd){
+    std::vector<char> data, reply;
+    for(;;){
+      std::array<char, 14> header;
+      if(!readFully(fd, header.data(), header.size())) return;
+      DaemonCommand command = static_cast<DaemonCommand>(header[0]);
+      ModelType type = static_cast<ModelType>(header[1]);
+      std::uint32_t parameter = 0;
+      std::uint64_t size = 0;
+      std::memcpy(&parameter, &header[2], sizeof(std::uint32_t));
+      std::memcpy(&size, &header[6], sizeof(std::uint64_t));
+      if(size > MaxRequest){
+        sendReply(fd, DaemonStatus::TooLarge, nullptr, 0);
+        return;
+      }
+      data.resize(size);
+      if(!readFully(fd, data.data(), size)) return;
+
+      auto start = std::chrono::steady_clock::now();
+      DaemonStatus status = DaemonStatus::Ok;
+      reply.clear();
+      switch(command){
+      case DaemonCommand::Compress:
+        status = !validModelType(header[1]) ? DaemonStatus::BadRequest : compress(type, parameter, data, reply);
+        break;
+      case DaemonCommand::Decompress:
+        status = decompress(data, reply);
+        break;
+      case DaemonCommand::Stats:{
+        std::string text = mStats.report() + mPool.report();
+        reply.assign(text.begin(), text.end());
+        break;
+      }
+      case DaemonCommand::Stop:
+        sendReply(fd, DaemonStatus::Ok, nullptr, 0);
+        stop();
+        return;
+      default:
+        status = DaemonStatus::BadRequest;
+      }
+      if(!sendReply(fd, status, reply.data(), reply.size())) return;
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      mStats.record(command, elapsed.count(), size, reply.size());
+    }
+  }
+
+  DaemonStatus compress(ModelType type, std::uint32_t parameter, std::vector<char> const& data, std::vector<char>& reply){
+    std::unique_ptr<Compressor> compressor = mPool.acquire(type, parameter);
+    if(!compressor) return DaemonStatus::TooLarge;
+    reply.resize(Compressor::bound(data.size()));
+    std::size_t size = 0;
+    Compressor::Status status = compressor->compress(data.data(), data.size(), reply.data(), reply.size(), size);
+    mPool.release(type, parameter, std::move(compressor));
+    reply.resize(size);
+    return status == Compressor::Status::Ok ? DaemonStatus::Ok : DaemonStatus::Corrupt;
+  }
+
+  DaemonStatus decompress(std::vector<char> const& data, std::vector<char>& reply){
+    // The compressor of the archive model, so that it keeps it
+    ArchiveHeader header;
+    {
+      MemoryStreamBuffer buffer(data.data(), data.size());
+      std::istream stream(&buffer);
+      if(!header.read(stream) || !validModelType(header.modelType)) return DaemonStatus::Corrupt;
+    }
+    if(header.totalSize() > MaxRequest) return DaemonStatus::TooLarge;
+    ModelType type = static_cast<ModelType>(header.modelType);
+    std::unique_ptr<Compressor> compressor = mPool.acquire(type, header.modelParameter);
+    if(!compressor) return DaemonStatus::TooLarge;
+    reply.resize(header.totalSize());
+    std::size_t size = 0;
+    Compressor::Status status = compressor->decompress(data.data(), data.size(), reply.data(), reply.size(), size);
+    mPool.release(type, header.modelParameter, std::move(compressor));
+    reply.resize(size);
+    return status == Compressor::Status::Ok ? DaemonStatus::Ok : DaemonStatus::Corrupt;
+  }
+
+  bool sendReply(int fd, DaemonStatus status, char const* data, std::uint64_t size){
+    std::array<char, 9> header;
+    header[0] = static_cast<char>(status);
+    std::memcpy(&header[1], &size, sizeof(std::uint64_t));
+    return writeFully(fd, header.data(), header.size()) && writeFully(fd, data, size);
+  }
+
+  // Wakes accept and the workers waiting on idle connections
+  void stop(){
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStopping = true;
+    ::shutdown(mListen, SHUT_RDWR);
+    for(int fd : mActive) ::shutdown(fd, SHUT_RD);
+    mWork.notify_all();
+  }
+
+  std::string mPath;
+  ModelPool& mPool;
+  LatencyStats mStats;
+  unsigned mWorkers;
+  int mListen;
+  std::string mError;
+
+  std::mutex mMutex;
+  std::condition_variable mWork;
+  std::deque<int> mPending;
+  std::set<int> mActive;
+  bool mStopping;
+};
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <cinttypes>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// --- Dictionary ---
+// Word replacement for text : every run of ASCII letters found in the
+// dictionary is replaced by a one or two byte code, so that the model sees
+// fewer bytes. Codes and escapes use the bytes above 0x7F :
+//   0x00 - 0x7F : the byte itself
+//   0x80 - 0xBF : one of the ShortCodes most useful words
+//   0xC0 - 0xFE : followed by a byte, one of the other words
+//   0xFF        : followed by a byte above 0x7F, the byte itself
+// Only whole runs are replaced, so that restoring the text needs no
+// separators. Stored front coded :
+//   uint8 short word count, uint16 long word count
+//   words : uint8 length shared with the previous word, suffix, 0
+
+class Dictionary {
+public:
+  static constexpr unsigned char FirstShort = 0x80;
+  static constexpr unsigned char FirstLong = 0xC0;
+  static constexpr unsigned char Escape = 0xFF;
+  static constexpr unsigned ShortCodes = FirstLong - FirstShort;
+  static constexpr unsigned LongCodes = (Escape - FirstLong) * 256;
+  static constexpr unsigned MaxLength = 32;
+  static constexpr std::size_t MaxCounted = 1u << 20;
+
+  using Counts = std::unordered_map<std::string, std::uint64_t>;
+
+  bool empty() const { return mWords.empty(); }
+  std::size_t size() const { return mWords.size(); }
+
+  static bool isLetter(unsigned char ch){
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+  }
+
+  // First pass : counts the letter runs of data
+  static void count(unsigned char const* data, std::size_t size, Counts& counts){
+    for(std::size_t i = 0; i < size;){
+      if(!isLetter(data[i])){
+        i++;
+        continue;
+      }
+      std::size_t j = i;
+      while(j < size && isLetter(data[j])) j++;
+      if(j - i >= 2 && j - i <= MaxLength){
+        counts[std::string(data + i, data + j)]++;
+      }
+      i = j;
+    }
+    // Huge inputs, forget the rarest words down to half the limit, so that
+    // the next chunks add as many words again before the map is walked
+    if(counts.size() > MaxCounted){
+      for(std::uint64_t least = 2; counts.size() > MaxCounted / 2; least *= 2){
+        for(auto it = counts.begin(); it != counts.end();){
+          it = it->second < least ? counts.erase(it) : std::next(it);
+        }
+      }
+    }
+  }
+
+  // Keeps the words that save more bytes than they cost in the dictionary,
+  // at most maxWords of them. The words saving the most get the short codes.
+  void build(Counts const& counts, unsigned maxWords = ShortCodes + LongCodes){
+    std::vector<std::pair<std::uint64_t, std::string>> candidates;
+    for(auto const& count : counts){
+      std::uint64_t length = count.first.size();
+      if(count.second * (length - 1) > length + 2){
+        candidates.emplace_back(count.second * (length - 1), count.first);
+      }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](std::pair<std::uint64_t, std::string> const& a, std::pair<std::uint64_t, std::string> const& b){
+      return a.first > b.first || (a.first == b.first && a.second < b.second);
+    });
+    std::vector<std::string> shortWords, longWords;
+    for(auto const& candidate : candidates){
+      if(shortWords.size() + longWords.size() >= maxWords) break;
+      std::uint64_t length = candidate.second.size();
+      std::uint64_t occurrences = candidate.first / (length - 1);
+      if(shortWords.size() < ShortCodes){
+        shortWords.push_back(candidate.second);
+      }else if(length > 2 && occurrences * (length - 2) > length + 2 && longWords.size() < LongCodes){
+        longWords.push_back(candidate.second);
+      }
+    }
+    // Sorted words share prefixes
+    std::sort(shortWords.begin(), shortWords.end());
+    std::sort(longWords.begin(), longWords.end());
+    setWords(shortWords, longWords);
+  }
+
+  // Bytes saved on the counted input, the dictionary itself included
+  std::int64_t savings(Counts const& counts) const {
+    std::int64_t result = -static_cast<std::int64_t>(storedSize());
+    for(unsigned i = 0; i < mWords.size(); ++i){
+      auto it = counts.find(mWords[i]);
+      if(it == counts.end()) continue;
+      result += it->second * (mWords[i].size() - (i < mShortCount ? 1 : 2));
+    }
+    return result;
+  }
+
+  // Replaced text goes to out, at most twice the size of data
+  void encode(unsigned char const* data, std::size_t size, std::vector<unsigned char>& out) const {
+    out.clear();
+    std::string word;
+    for(std::size_t i = 0; i < size;){
+      if(!isLetter(data[i])){
+        if(data[i] >= FirstShort) out.push_back(static_cast<unsigned char>(Escape));
+        out.push_back(data[i++]);
+        continue;
+      }
+      std::size_t j = i;
+      while(j < size && isLetter(data[j])) j++;
+      word.assign(data + i, data + j);
+      auto it = mCodes.find(word);
+      if(it == mCodes.end()){
+        out.insert(out.end(), data + i, data + j);
+      }else if(it->second < mShortCount){
+        out.push_back(FirstShort + it->second);
+      }else{
+        unsigned code = it->second - mShortCount;
+        out.push_back(FirstLong + (code >> 8));
+        out.push_back(code & 0xFF);
+      }
+      i = j;
+    }
+  }
+
+  // False on codes the dictionary does not have
+  bool decode(unsigned char const* data, std::size_t size, std::vector<unsigned char>& out) const {
+    out.clear();
+    for(std::size_t i = 0; i < size; ++i){
+      unsigned char ch = data[i];
+      if(ch < FirstShort){
+        out.push_back(ch);
+        continue;
+      }
+      if(ch != Escape && ch < FirstLong){
+        if(static_cast<unsigned>(ch - FirstShort) >= mShortCount) return false;
+        std::string const& word = mWords[ch - FirstShort];
+        out.insert(out.end(), word.begin(), word.end());
+        continue;
+      }
+      if(++i == size) return false;
+      if(ch == Escape){
+        out.push_back(data[i]);
+        continue;
+      }
+      unsigned code = mShortCount + ((ch - FirstLong) << 8) + data[i];
+      if(code >= mWords.size()) return false;
+      out.insert(out.end(), mWords[code].begin(), mWords[code].end());
+    }
+    return true;
+  }
+
+  std::size_t storedSize() const {
+    std::size_t result = 3;
+    for(unsigned i = 0; i < mWords.size(); ++i){
+      result += 2 + mWords[i].size() - sharedLength(i);
+    }
+    return result;
+  }
+
+  void write(std::ostream& stream) const {
+    stream.put(static_cast<char>(mShortCount));
+    std::uint16_t longCount = mWords.size() - mShortCount;
+    stream.write((char const*) &longCount, sizeof(std::uint16_t));
+    for(unsigned i = 0; i < mWords.size(); ++i){
+      unsigned shared = sharedLength(i);
+      stream.put(static_cast<char>(shared));
+      stream.write(mWords[i].data() + shared, mWords[i].size() - shared);
+      stream.put(0);
+    }
+  }
+
+  bool read(std::istream& stream){
+    unsigned shortCount = stream.get();
+    std::uint16_t longCount = 0;
+    stream.read((char*) &longCount, sizeof(std::uint16_t));
+    if(!stream.good() || shortCount > ShortCodes || longCount > LongCodes) return false;
+    std::vector<std::string> words(shortCount + longCount);
+    for(unsigned i = 0; i < words.size() && stream.good(); ++i){
+      unsigned shared = stream.get();
+      if(shared > (i == 0 || i == shortCount ? 0 : words[i - 1].size())) return false;
+      std::string suffix;
+      std::getline(stream, suffix, '\0');
+      words[i] = (shared == 0 ? std::string() : words[i - 1].substr(0, shared)) + suffix;
+    }
+    if(!stream.good()) return false;
+    setWords(std::vector<std::string>(words.begin(), words.begin() + shortCount),
+      std::vector<std::string>(words.begin() + shortCount, words.end()));
+    return true;
+  }
+
+private:
+  // Prefix shared with the previous word of the same code length
+  unsigned sharedLength(unsigned i) const {
+    if(i == 0 || i == mShortCount) return 0;
+    std::string const& a = mWords[i - 1];
+    std::string const& b = mWords[i];
+    unsigned shared = 0;
+    while(shared < a.size() && shared < b.size() && a[shared] == b[shared]) shared++;
+    return shared;
+  }
+
+  void setWords(std::vector<std::string> const& shortWords, std::vector<std::string> const& longWords){
+    mWords = shortWords;
+    mWords.insert(mWords.end(), longWords.begin(), longWords.end());
+    mShortCount = shortWords.size();
+    mCodes.clear();
+    for(unsigned i = 0; i < mWords.size(); ++i){
+      mCodes[mWords[i]] = i;
+    }
+  }
+
+  std::vector<std::string> mWords;
+  unsigned mShortCount = 0;
+  std::unordered_map<std::string, unsigned> mCodes;
+};
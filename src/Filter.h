@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cinttypes>
+#include <cctype>
+#include <cmath>
+#include <array>
+#include <string>
+#include <vector>
+
+// --- Filter ---
+// Reversible transform applied to every chunk before it reaches the model.
+// Chunks are filtered on their own, so that each one can be restored without
+// its neighbours; position is the offset of the chunk in the archive content.
+//   E8E9  : x86 CALL/JMP relative addresses made absolute
+//   Delta : difference with the byte parameter bytes back
+//   Split : words of parameter & 0xFF bytes cut in byte planes, most
+//           significant plane first, big endian words when parameter & 0x100
+
+enum class FilterType : std::uint8_t {
+  None,
+  E8E9,
+  Delta,
+  Split
+};
+
+class Filter {
+public:
+  Filter(FilterType type = FilterType::None, std::uint32_t parameter = 0) :
+  mType(type), mParameter(parameter){
+    if(mType == FilterType::Delta && mParameter == 0) mParameter = 1;
+    if(mType == FilterType::Split && (mParameter & 0xFF) < 2) mParameter = (mParameter & 0x100) | 2;
+  }
+
+  FilterType type() const { return mType; }
+  std::uint32_t parameter() const { return mParameter; }
+
+  std::string name() const {
+    switch(mType){
+    case FilterType::None: return "none";
+    case FilterType::E8E9: return "e8e9";
+    case FilterType::Delta: return "delta:" + std::to_string(mParameter);
+    case FilterType::Split: return "split:" + std::to_string(mParameter & 0xFF) + ((mParameter & 0x100) ? "be" : "le");
+    }
+    return "";
+  }
+
+  void encode(unsigned char* data, std::size_t size, std::uint64_t position){
+    switch(mType){
+    case FilterType::None:
+      break;
+    case FilterType::E8E9:
+      e8e9(data, size, position, true);
+      break;
+    case FilterType::Delta:
+      for(std::size_t i = size; i-- > mParameter;){
+        data[i] -= data[i - mParameter];
+      }
+      break;
+    case FilterType::Split:
+      split(data, size, true);
+      break;
+    }
+  }
+
+  void decode(unsigned char* data, std::size_t size, std::uint64_t position){
+    switch(mType){
+    case FilterType::None:
+      break;
+    case FilterType::E8E9:
+      e8e9(data, size, position, false);
+      break;
+    case FilterType::Delta:
+      for(std::size_t i = mParameter; i < size; ++i){
+        data[i] += data[i - mParameter];
+      }
+      break;
+    case FilterType::Split:
+      split(data, size, false);
+      break;
+    }
+  }
+
+  // Picks the filter for the samples : E8E9 when they look like x86 code,
+  // otherwise the delta or split filter that lowers the order 1 entropy by
+  // more than a tenth, if any
+  static Filter detect(std::vector<std::vector<unsigned char>> const& samples){
+    std::size_t size = 0, calls = 0;
+    for(std::vector<unsigned char> const& sample : samples){
+      size += sample.size();
+      for(std::size_t i = 0; i + 4 < sample.size(); ++i){
+        if((sample[i] == 0xE8 || sample[i] == 0xE9) && (sample[i + 4] == 0x00 || sample[i + 4] == 0xFF)){
+          calls++;
+        }
+      }
+    }
+    if(calls >= 16 && calls * 200 >= size){
+      return Filter(FilterType::E8E9);
+    }
+
+    static const std::uint32_t candidates[][2] = {
+      { static_cast<std::uint32_t>(FilterType::Delta), 1 },
+      { static_cast<std::uint32_t>(FilterType::Delta), 2 },
+      { static_cast<std::uint32_t>(FilterType::Delta), 4 },
+      { static_cast<std::uint32_t>(FilterType::Split), 2 },
+      { static_cast<std::uint32_t>(FilterType::Split), 4 },
+      { static_cast<std::uint32_t>(FilterType::Split), 0x102 },
+      { static_cast<std::uint32_t>(FilterType::Split), 0x104 }
+    };
+    Filter best;
+    double bestEntropy = 0.9 * entropy(samples, best);
+    for(auto const& candidate : candidates){
+      Filter filter(static_cast<FilterType>(candidate[0]), candidate[1]);
+      double e = entropy(samples, filter);
+      if(e < bestEntropy){
+        best = filter;
+        bestEntropy = e;
+      }
+    }
+    return best;
+  }
+
+private:
+  // Bits per byte of an order 1 model, closer to what the context model sees
+  // than the order 0 entropy
+  static double entropy(std::vector<std::vector<unsigned char>> const& samples, Filter& filter){
+    std::vector<std::uint32_t> histogram(1 << 16);
+    std::array<std::uint64_t, 256> contexts{};
+    std::uint64_t size = 0;
+    for(std::vector<unsigned char> sample : samples){
+      filter.encode(sample.data(), sample.size(), 0);
+      for(std::size_t i = 1; i < sample.size(); ++i){
+        histogram[(sample[i - 1] << 8) | sample[i]]++;
+        contexts[sample[i - 1]]++;
+      }
+      size += sample.size() > 0 ? sample.size() - 1 : 0;
+    }
+    double result = 0.0;
+    for(unsigned i = 0; i < histogram.size(); ++i){
+      if(histogram[i] == 0) continue;
+      result -= histogram[i] * std::log2(static_cast<double>(histogram[i]) / contexts[i >> 8]);
+    }
+    return size == 0 ? 0.0 : result / size;
+  }
+
+  static void e8e9(unsigned char* data, std::size_t size, std::uint64_t position, bool encode){
+    for(std::size_t i = 0; i + 4 < size; ++i){
+      if(data[i] != 0xE8 && data[i] != 0xE9) continue;
+      std::uint32_t address = data[i + 1] | (data[i + 2] << 8) | (data[i + 3] << 16) | (static_cast<std::uint32_t>(data[i + 4]) << 24);
+      std::uint32_t offset = static_cast<std::uint32_t>(position + i);
+      address = encode ? address + offset : address - offset;
+      for(unsigned k = 0; k < 4; ++k){
+        data[i + 1 + k] = address >> (8 * k);
+      }
+      i += 4;
+    }
+  }
+
+  // The tail that does not fill a word is left in place
+  void split(unsigned char* data, std::size_t size, bool encode){
+    unsigned width = mParameter & 0xFF;
+    bool bigEndian = mParameter & 0x100;
+    std::size_t words = size / width;
+    mBuffer.assign(data, data + words * width);
+    for(std::size_t w = 0; w < words; ++w){
+      for(unsigned b = 0; b < width; ++b){
+        // Plane 0 holds the most significant bytes
+        unsigned plane = bigEndian ? b : width - 1 - b;
+        if(encode){
+          data[plane * words + w] = mBuffer[w * width + b];
+        }else{
+          data[w * width + b] = mBuffer[plane * words + w];
+        }
+      }
+    }
+  }
+
+  FilterType mType;
+  std::uint32_t mParameter;
+  std::vector<unsigned char> mBuffer;
+};
+
+// Reads the names Filter::name() gives
+inline bool parseFilter(std::string const& name, Filter& filter){
+  std::size_t colon = name.find(':');
+  std::string type = name.substr(0, colon);
+  std::string parameter = colon == std::string::npos ? "" : name.substr(colon + 1);
+  if(type == "none" || type == "e8e9"){
+    filter = Filter(type == "none" ? FilterType::None : FilterType::E8E9);
+    return parameter.empty();
+  }
+  if(parameter.empty() || !std::isdigit(static_cast<unsigned char>(parameter[0]))) return false;
+  std::size_t end = 0;
+  unsigned long value = std::stoul(parameter, &end);
+  std::string suffix = parameter.substr(end);
+  if(type == "delta" && suffix.empty() && value > 0 && value <= (1 << 16)){
+    filter = Filter(FilterType::Delta, value);
+    return true;
+  }
+  if(type == "split" && (suffix.empty() || suffix == "le" || suffix == "be") && value >= 2 && value < 256){
+    filter = Filter(FilterType::Split, value | (suffix == "be" ? 0x100 : 0));
+    return true;
+  }
+  return false;
+}
@@ -1,37 +1,69 @@
 #pragma once
 
 #include <cinttypes>
+#include <cassert>
 #include <iostream>
-
-template<unsigned IB, unsigned FB>
+#include <limits>
+#include <type_traits>
+
+// IB integer bits (sign included) and FB fraction bits stored in T. Products
+// and quotients are computed in Wide, twice the width of T, and wrap like T
+// does unless the saturating versions are used. Types narrower than 32 bits
+// are meant for storage : exp and subOneLn need 32 bits.
+template<unsigned IB, unsigned FB, typename T = std::int32_t>
 class FixedPoint {
-  static_assert(IB + FB == 32, "");
-  static constexpr std::int32_t unit = 1 << FB;
-  static constexpr std::int32_t zero = 0;
-  static constexpr std::int32_t maximum = 0x7FFFFFFF;
+  static_assert(std::is_signed<T>::value && IB + FB == 8 * sizeof(T), "");
+  static_assert(sizeof(T) <= 4, "");
+  using Wide = typename std::conditional<sizeof(T) <= 2, std::int32_t, std::int64_t>::type;
+  static constexpr T unit = static_cast<T>(1) << FB;
+  static constexpr T zero = 0;
+  static constexpr T maximum = std::numeric_limits<T>::max();
+  static constexpr T minimum = std::numeric_limits<T>::min();
 
-  using SelfType = FixedPoint<IB, FB>;
+  using SelfType = FixedPoint<IB, FB, T>;
 
 public:
+  using Storage = T;
+
   constexpr FixedPoint() : mValue(zero){ }
-  constexpr FixedPoint(double const& d) : mValue(static_cast<std::int32_t>(d * unit)){ }
-  constexpr FixedPoint(float const& d) : mValue(static_cast<std::int32_t>(d * unit)){ }
-  constexpr FixedPoint(int const& d) : mValue(static_cast<std::int32_t>(d * unit)){ }
+  // Scaling by a power of two is exact and truncation is the same on every
+  // IEEE host, but models only convert constants, never computed values.
+  // By value, so that converting a static constexpr member does not need its
+  // definition.
+  constexpr FixedPoint(double d) : mValue(static_cast<T>(d * unit)){ }
+  constexpr FixedPoint(float d) : mValue(static_cast<T>(d * unit)){ }
+  constexpr FixedPoint(int d) : mValue(static_cast<T>(d * unit)){ }
 
   double asDouble() const{
     return ((double) mValue) / ((double) unit);
   }
   
-  static constexpr SelfType FromValue(std::int32_t value){
+  static constexpr SelfType FromValue(T value){
     SelfType r = SelfType(); r.mValue = value; return r;
   }
 
+  // Clamps a raw value to the range of T
+  static constexpr SelfType Saturate(std::int64_t value){
+    return FromValue(value > maximum ? maximum : (value < minimum ? minimum : static_cast<T>(value)));
+  }
+
+  // The same number in this format, rounded to nearest and saturated
+  template<unsigned IB2, unsigned FB2, typename T2>
+  static SelfType From(FixedPoint<IB2, FB2, T2> const& other){
+    std::int64_t value = other.value();
+    if(FB >= FB2){
+      return Saturate(value * (static_cast<std::int64_t>(1) << (FB - FB2)));
+    }
+    unsigned shift = FB2 > FB ? FB2 - FB : 0;
+    return Saturate((value + (static_cast<std::int64_t>(1) << (shift - 1))) >> shift);
+  }
+
   static constexpr SelfType Unit(){
     return FromValue(unit);
   }
 
 
-  std::int32_t value() const {
+  T value() const {
     return mValue;
   }
 
@@ -55,8 +87,8 @@ public:
 
   constexpr SelfType operator*(SelfType const& other) const{
     SelfType tmp = SelfType();
-    std::int64_t a = mValue, b = other.mValue;
-    tmp.mValue = static_cast<std::int32_t>((a * b) >> FB);
+    Wide a = mValue, b = other.mValue;
+    tmp.mValue = static_cast<T>((a * b) >> FB);
     return tmp;
   }
   void operator*=(SelfType const& other){
@@ -74,17 +106,58 @@ public:
       }
     }
     SelfType tmp = SelfType();
-    std::int64_t a = mValue, b = other.mValue;
-    tmp.mValue = static_cast<std::int32_t>((a << FB) / b);
+    Wide a = mValue, b = other.mValue;
+    tmp.mValue = static_cast<T>((a << FB) / b);
     return tmp;
   }
   void operator/=(SelfType const& other){
     *this = *this / other;
   }
 
+  // --- Saturating arithmetic ---
+  SelfType saturatingAdd(SelfType const& other) const{
+    return Saturate(static_cast<std::int64_t>(mValue) + other.mValue);
+  }
+  SelfType saturatingSub(SelfType const& other) const{
+    return Saturate(static_cast<std::int64_t>(mValue) - other.mValue);
+  }
+  SelfType saturatingMul(SelfType const& other) const{
+    return Saturate((static_cast<std::int64_t>(mValue) * other.mValue) >> FB);
+  }
+
+  // 1 / x without a division : the magnitude is normalised to a mantissa m
+  // in [0.5, 1), 1 / m starts from the linear estimate 48/17 - 32/17 m and
+  // three Newton steps r = r (2 - m r) bring it to 30 bits. Rounded to
+  // nearest and saturated, 1 / 0 gives maximum.
+  SelfType reciprocal() const{
+    if(mValue == 0) return FromValue(maximum);
+    std::uint64_t x = mValue < 0 ? -static_cast<std::int64_t>(mValue) : mValue;
+    // m = x << n, 0.32 fixed point
+    unsigned n = 0;
+    while(!(x & 0x80000000u)){
+      x <<= 1;
+      n++;
+    }
+    // r is 2.30 fixed point
+    std::uint64_t r = 3031741621u - ((2021161080u * x) >> 32);
+    for(unsigned i = 0; i < 3; ++i){
+      std::uint64_t error = ((std::uint64_t(1) << 63) - r * x) >> 32;
+      r = (r * error) >> 30;
+    }
+    // x / 2^FB = m 2^(32 - n - FB), so the result is r 2^(n + 2 FB - 62)
+    int shift = static_cast<int>(n + 2 * FB) - 62;
+    std::int64_t result;
+    if(shift >= 0){
+      result = shift >= 63 || (r >> (63 - shift)) != 0 ? std::numeric_limits<std::int64_t>::max() : static_cast<std::int64_t>(r << shift);
+    }else{
+      result = -shift >= 40 ? 0 : static_cast<std::int64_t>((r + (std::uint64_t(1) << (-shift - 1))) >> -shift);
+    }
+    return Saturate(mValue < 0 ? -result : result);
+  }
+
   bool operator==(SelfType const& other) const { return mValue == other.mValue; }
   bool operator!=(SelfType const& other) const { return mValue != other.mValue; }
-  bool operator<(SelfType const& other) const { return mValue <= other.mValue; }
+  bool operator<(SelfType const& other) const { return mValue < other.mValue; }
   bool operator<=(SelfType const& other) const { return mValue <= other.mValue; }
   bool operator>(SelfType const& other) const { return mValue > other.mValue; }
   bool operator>=(SelfType const& other) const { return mValue >= other.mValue; }
@@ -93,18 +166,21 @@ public:
   SelfType subOneLn() const;
 
 private:
-  std::int32_t mValue;
+  T mValue;
 };
 
-template<unsigned IB, unsigned FB>
-constexpr std::int32_t FixedPoint<IB, FB>::unit;
-template<unsigned IB, unsigned FB>
-constexpr std::int32_t FixedPoint<IB, FB>::zero;
-template<unsigned IB, unsigned FB>
-constexpr std::int32_t FixedPoint<IB, FB>::maximum;
+template<unsigned IB, unsigned FB, typename T>
+constexpr T FixedPoint<IB, FB, T>::unit;
+template<unsigned IB, unsigned FB, typename T>
+constexpr T FixedPoint<IB, FB, T>::zero;
+template<unsigned IB, unsigned FB, typename T>
+constexpr T FixedPoint<IB, FB, T>::maximum;
+template<unsigned IB, unsigned FB, typename T>
+constexpr T FixedPoint<IB, FB, T>::minimum;
 
 #include "FixedPointExp.inl"
 #include "FixedPointSubOneLn.inl"
 
 using FixedPoint24 = FixedPoint<8, 24>;
-using FixedPoint20 = FixedPoint<12, 20>;
\ No newline at end of file
+using FixedPoint20 = FixedPoint<12, 20>;
+using FixedPoint16 = FixedPoint<4, 12, std::int16_t>;
\ No newline at end of file
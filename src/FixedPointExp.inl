@@ -1,5 +1,5 @@
-template<unsigned IB, unsigned FB>
-FixedPoint<IB, FB> FixedPoint<IB, FB>::exp() const{
+template<unsigned IB, unsigned FB, typename T>
+FixedPoint<IB, FB, T> FixedPoint<IB, FB, T>::exp() const{
   // exp(exp_table_1[i]) = 2^(i);
   // exp(exp_table_1[IB-1]) = 2^(IB);
   static constexpr SelfType exp_table_1 [32] = {
@@ -1,5 +1,5 @@
-template<unsigned IB, unsigned FB>
-FixedPoint<IB, FB> FixedPoint<IB, FB>::subOneLn() const{
+template<unsigned IB, unsigned FB, typename T>
+FixedPoint<IB, FB, T> FixedPoint<IB, FB, T>::subOneLn() const{
   // exp(exp_table_1[i]) = 2^(i);
   // exp_table_1[i] = ln(2^(i+1))
   static constexpr SelfType exp_table_1 [32] = {
@@ -113,17 +113,18 @@ FixedPoint<IB, FB> FixedPoint<IB, FB>::subOneLn() const{
 
   SelfType result = SelfType();
 
-  unsigned lo = 0, hi = IB;
+  // ln(x) = ln(x * 2^lo) - lo * ln(2), with x * 2^lo in [1/2, 1]
+  unsigned lo = 0, hi = FB;
   while(lo != hi){
     unsigned mid = (lo + hi) / 2;
-    if(x < (1 << mid)){
+    if((static_cast<std::int64_t>(x) << mid) >= (unit >> 1)){
       hi = mid;
     } else {
       lo = mid + 1;
     }
   }
-  result -= exp_table_1[IB-lo].mValue;
-  x >>= (IB-lo);
+  result -= exp_table_1[lo];
+  x <<= lo;
 
   for(unsigned i = 0; i < 31; ++i){
     if(x < exp_table_3[i].mValue){
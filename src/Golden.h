@@ -0,0 +1,190 @@
+#pragma once
+
+#include "Model.h"
+#include "RNAModel.h"
+#include "BitRNAModel.h"
+#include "BitPPMModel.h"
+#include "BytePPMModel.h"
+#include "MixModel.h"
+#include "ModelSelection.h"
+
+#include <fstream>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// --- Golden predictions ---
+// Encoder and decoder must compute the same predictions, including when they
+// run different builds on different hosts. The models only use integer
+// arithmetic, so a digest of the predictions of each model on fixed inputs
+// is the same everywhere : GoldenModels lists the digests of this tree, on
+// the synthetic sample and on prefixes of Calgary files of other kinds.
+
+// Text-like words then fixed size records, drawn with minstd_rand which the
+// standard fully specifies
+inline std::vector<unsigned char> goldenSample(){
+  static char const* const words[] = {
+    "the", "of", "and", "model", "context", "weight", "predict", "archive",
+    "a", "to", "in", "is", "bit", "byte", "order", "hash"
+  };
+  std::minstd_rand random(20161019);
+  std::vector<unsigned char> sample;
+  while(sample.size() < 24 * 1024){
+    std::string word = words[random() % 16];
+    sample.insert(sample.end(), word.begin(), word.end());
+    sample.push_back(random() % 12 == 0 ? '\n' : ' ');
+  }
+  for(std::uint32_t record = 0; record < 1024; ++record){
+    std::uint32_t fields[2] = { record * 37, static_cast<std::uint32_t>(random() % 1000) };
+    for(std::uint32_t field : fields){
+      for(unsigned k = 0; k < 4; ++k) sample.push_back(field >> (8 * k));
+    }
+  }
+  return sample;
+}
+
+struct GoldenInput {
+  std::string name;
+  std::vector<unsigned char> data; // Empty when the file is missing
+};
+
+// The synthetic sample, then the first GoldenPrefix bytes of a text, an
+// executable and a bitmap of the Calgary corpus under directory
+static constexpr std::size_t GoldenPrefix = 16 * 1024;
+
+inline std::vector<GoldenInput> goldenInputs(std::string const& directory){
+  std::vector<GoldenInput> inputs;
+  inputs.push_back({ "golden sample", goldenSample() });
+  for(char const* name : { "paper1", "obj1", "pic" }){
+    std::string path = directory + "/" + name;
+    std::ifstream file(path, std::ios::binary);
+    std::vector<unsigned char> data(GoldenPrefix);
+    file.read(reinterpret_cast<char*>(data.data()), data.size());
+    data.resize(file.gcount() == static_cast<std::streamsize>(GoldenPrefix) ? GoldenPrefix : 0);
+    inputs.push_back({ path, std::move(data) });
+  }
+  return inputs;
+}
+
+// FNV-1a over the little endian predictions of every bit
+inline std::uint64_t predictionDigest(Model& model, std::vector<unsigned char> const& data){
+  std::uint64_t digest = 14695981039346656037ull;
+  for(unsigned char ch : data){
+    for(unsigned i = 0; i < 8; ++i){
+      bool bit = ch & (1 << (7-i));
+      std::uint32_t pred = model.predict();
+      for(unsigned k = 0; k < 4; ++k){
+        digest = (digest ^ ((pred >> (8 * k)) & 0xFF)) * 1099511628211ull;
+      }
+      model.update(bit);
+    }
+  }
+  return digest;
+}
+
+// Mix of a small RNAModel and a BitPPMModel, owning them
+struct GoldenMixInputs {
+  RNAModel<SmallRNAContext> rna;
+  BitPPMModel<16> ppm;
+};
+
+class GoldenMix : private GoldenMixInputs, public MixModel {
+public:
+  GoldenMix(bool parallel = false) : MixModel({ &rna, &ppm }){
+    setParallel(parallel);
+  }
+};
+
+// --- Fixed point checks ---
+// The saturating operations of FixedPoint16 against 64 bit results clamped
+// to its range, on a grid of operands which includes both ends, and
+// reciprocal() against 1 / x, saturated : within half an ulp on every nonzero
+// FixedPoint16, and within half an ulp plus 2e-9 relative on FixedPoint20
+// values of every magnitude. The number of failures.
+
+template<typename F>
+inline bool reciprocalClose(typename F::Storage v){
+  double const unit = F::Unit().value();
+  double const maximum = std::numeric_limits<typename F::Storage>::max(), minimum = std::numeric_limits<typename F::Storage>::min();
+  double exact = unit * unit / v;
+  double expected = std::max(minimum, std::min(maximum, exact));
+  // Rounding, and the 2^-30 of the Newton steps on 32 bit results
+  return std::fabs(F::FromValue(v).reciprocal().value() - expected) <= 0.5 + std::fabs(exact) * 2e-9;
+}
+
+inline unsigned fixedPointFailures(){
+  using Storage = FixedPoint16::Storage;
+  std::int64_t const maximum = std::numeric_limits<Storage>::max(), minimum = std::numeric_limits<Storage>::min();
+  auto clamp = [&](std::int64_t v){ return std::max(minimum, std::min(maximum, v)); };
+  unsigned failures = 0;
+  for(std::int64_t a = minimum; a <= maximum; a += a + 257 > maximum && a != maximum ? maximum - a : 257){
+    for(std::int64_t b = minimum; b <= maximum; b += b + 257 > maximum && b != maximum ? maximum - b : 257){
+      FixedPoint16 x = FixedPoint16::FromValue(a), y = FixedPoint16::FromValue(b);
+      failures += x.saturatingAdd(y).value() != clamp(a + b);
+      failures += x.saturatingSub(y).value() != clamp(a - b);
+      failures += x.saturatingMul(y).value() != clamp((a * b) >> 12);
+    }
+  }
+  for(std::int64_t v = minimum; v <= maximum; ++v){
+    failures += v != 0 && !reciprocalClose<FixedPoint16>(static_cast<Storage>(v));
+  }
+  std::minstd_rand random(20161019);
+  for(unsigned i = 0; i < 100000; ++i){
+    // Magnitudes spread over every power of two
+    std::int32_t v = static_cast<std::int32_t>(random());
+    v = (v >> (random() % 31)) * (i % 2 ? 1 : -1);
+    failures += v != 0 && !reciprocalClose<FixedPoint20>(v);
+  }
+  return failures;
+}
+
+struct GoldenModel {
+  std::string name;
+  std::function<std::unique_ptr<Model>()> make;
+  std::vector<std::uint64_t> digests; // On each of goldenInputs()
+};
+
+inline std::vector<GoldenModel> goldenModels(){
+  auto type = [](ModelType t, std::uint32_t parameter){
+    return [=](){ return makeModel(t, parameter); };
+  };
+  return {
+    { "large", type(ModelType::Large, 0), {
+      0xc42f55624fee5021ull, 0x238c93a30babf317ull,
+      0x95664f2df2d5dfd2ull, 0xd4fd202aa29709d8ull } },
+    { "small", type(ModelType::Small, 0), {
+      0x93e6ba58e5cbcf36ull, 0x92141de6d550d3f4ull,
+      0x27f656165c0ee07bull, 0x227cc69ac10cfa69ull } },
+    { "simple", type(ModelType::Simple, 0), {
+      0x15f31843f1b3dc10ull, 0x293e65ee547acc61ull,
+      0xa961c8ccda16778bull, 0x5a0a9fb0497558cfull } },
+    { "records:8", type(ModelType::Records, 8), {
+      0x21463e7cdb4e266eull, 0xd3be56d8a45cd40bull,
+      0xa8d5eb41e03f5382ull, 0xde85ded1f7371964ull } },
+    { "compact", type(ModelType::Compact, 0), {
+      0x724b2134b1965832ull, 0x4461ea3f005ab7ccull,
+      0xa0b000f035e535b5ull, 0xd5be5b463eee320aull } },
+    { "indirect", type(ModelType::Indirect, 0), {
+      0xd3039c1f70589c40ull, 0x5baf1808328f39b2ull,
+      0x39d4cb3e17d62588ull, 0x7ce3ae3a5492c96eull } },
+    { "bitrna", [](){ return std::unique_ptr<Model>(new BitRNAModel<16>()); }, {
+      0xc237770b4207c9c3ull, 0xf9ab85118a6743e0ull,
+      0xa3b9328c196de701ull, 0xee602f83846367b7ull } },
+    { "bitppm", [](){ return std::unique_ptr<Model>(new BitPPMModel<16>()); }, {
+      0x4f3f41ca0458fd31ull, 0x18e6136692760183ull,
+      0x92562a829b4d06e3ull, 0xab587a4c4d450182ull } },
+    { "byteppm", [](){ return std::unique_ptr<Model>(new BytePPMModel<3>(4)); }, {
+      0x251cc652924988dbull, 0x4623b18c6c5f53e5ull,
+      0xe918e771a13fbdafull, 0xf76092c89c509429ull } },
+    { "mix", [](){ return std::unique_ptr<Model>(new GoldenMix()); }, {
+      0xd11c847df4ff6352ull, 0xbc12cfdfb4000168ull,
+      0xa9ceb7744f5399f8ull, 0xfbad80198c8ad96aull } },
+    { "mix:parallel", [](){ return std::unique_ptr<Model>(new GoldenMix(true)); }, {
+      0xd11c847df4ff6352ull, 0xbc12cfdfb4000168ull,
+      0xa9ceb7744f5399f8ull, 0xfbad80198c8ad96aull } },
+  };
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include "Model.h"
+#include "RNAModel.h"
+#include "SquashTable.h"
+
+#include <array>
+#include <cinttypes>
+#include <vector>
+
+// --- BitHistory ---
+// 8 bit summary of the bits seen in a context : how many zeros and ones, 0
+// to 15 each. Seeing a bit counts it and halves a large count of the other
+// bit, so that a context which changes its mind is believed quickly. The
+// zeroed state is the empty history.
+
+class BitHistory {
+public:
+  static BitHistory const& get(){
+    static BitHistory const table;
+    return table;
+  }
+
+  std::uint8_t next(std::uint8_t state, bool bit) const {
+    return mNext[2 * state + bit];
+  }
+
+  static unsigned zeros(std::uint8_t state){ return state >> 4; }
+  static unsigned ones(std::uint8_t state){ return state & 15; }
+
+private:
+  BitHistory(){
+    for(unsigned state = 0; state < 256; ++state){
+      for(unsigned bit = 0; bit < 2; ++bit){
+        unsigned counts[2] = { zeros(state), ones(state) };
+        counts[bit] = std::min(counts[bit] + 1, 15u);
+        if(counts[!bit] > 2) counts[!bit] = counts[!bit] / 2 + 1;
+        mNext[2 * state + bit] = static_cast<std::uint8_t>((counts[0] << 4) | counts[1]);
+      }
+    }
+  }
+
+  std::array<std::uint8_t, 512> mNext;
+};
+
+// --- StretchTable ---
+// ln(p / (1 - p)), the inverse of the logistic function, for 12 bit
+// probabilities. Computed once with the fixed point logarithm, like the
+// squash and cost tables.
+
+class StretchTable {
+public:
+  static constexpr unsigned Bits = 12;
+
+  static StretchTable const& get(){
+    static StretchTable const table;
+    return table;
+  }
+
+  // p is a 32 bit probability
+  FixedPoint20 stretch(std::uint32_t p) const {
+    return mTable[p >> (32 - Bits)];
+  }
+
+private:
+  StretchTable(){
+    for(unsigned i = 0; i < (1u << Bits); ++i){
+      FixedPoint24 p = FixedPoint24::FromValue((i << (24 - Bits)) + (1 << (23 - Bits)));
+      mTable[i] = FixedPoint20::From(p.subOneLn() - (FixedPoint24::Unit() - p).subOneLn());
+    }
+  }
+
+  std::array<FixedPoint20, 1 << Bits> mTable;
+};
+
+// --- IndirectModel ---
+// Each context slot of Ctx holds a BitHistory instead of a weight : one byte
+// rather than four, so the tables are a quarter of the RNAModel ones. The
+// history of each context order is mapped to a probability learnt for that
+// order and that history, which adapts at 1 / count until Limit. The
+// stretched probabilities of the orders are mixed with a weight set per bit
+// position, trained online like MixModel.
+
+template<typename Ctx>
+class IndirectModel : public Model {
+  static constexpr unsigned Contexts = Ctx::Contexts;
+public:
+  static constexpr double DefaultRate = 0.002;
+  static constexpr unsigned Limit = 127;
+
+  IndirectModel(Ctx const& context = Ctx(), FixedPoint20 rate = FixedPoint20(DefaultRate)) :
+  mContext(context),
+  mStates(Ctx::ContextSize),
+  mRate(rate),
+  mBit(0)
+  {
+    initMaps();
+  }
+
+  virtual std::uint32_t predict() override {
+    unsigned k = 0;
+    mContext.iterateOnContext([&](unsigned i){
+      mSlots[k++] = i;
+    });
+    return mix();
+  }
+
+  virtual void update(bool b) override {
+    train(b);
+    mContext.update(b);
+    mBit = (mBit + 1) & 7;
+  }
+
+  virtual void encode(Encoder& encoder, unsigned char byte) override {
+    codeByte([&](std::uint32_t pred, unsigned i){
+      bool bit = byte & (0x80 >> i);
+      encoder.encode(bit, pred);
+      return bit;
+    });
+  }
+
+  virtual unsigned char decode(Decoder& decoder) override {
+    unsigned char byte = 0;
+    codeByte([&](std::uint32_t pred, unsigned i){
+      bool bit = decoder.decode(pred);
+      byte |= bit << (7 - i);
+      return bit;
+    });
+    return byte;
+  }
+
+  virtual void predictByte(unsigned char byte, std::uint32_t* predictions) override {
+    codeByte([&](std::uint32_t pred, unsigned i){
+      predictions[i] = pred;
+      return static_cast<bool>(byte & (0x80 >> i));
+    });
+  }
+
+  virtual void learn(unsigned char byte) override {
+    codeByte([&](std::uint32_t, unsigned i){
+      return static_cast<bool>(byte & (0x80 >> i));
+    });
+  }
+
+  virtual void reset() override {
+    mContext.reset();
+    mStates.reset();
+    initMaps();
+    mBit = 0;
+  }
+
+  virtual bool save(SnapshotWriter& writer) const override {
+    writer.section("IndirectModel");
+    mContext.save(writer);
+    mStates.save(writer);
+    writer.array(mMaps.data(), mMaps.size());
+    writer.array(mWeights.data(), mWeights.size());
+    writer.value(mBit);
+    return writer.good();
+  }
+
+  virtual bool restore(SnapshotReader& reader) override {
+    if(!reader.section("IndirectModel") || !mContext.restore(reader) || !mStates.restore(reader)
+      || !reader.copyArray(mMaps.data(), mMaps.size()) || !reader.copyArray(mWeights.data(), mWeights.size())){
+      return false;
+    }
+    reader.value(mBit);
+    return reader.good() && mBit < 8;
+  }
+
+private:
+  // A map entry is a 22 bit probability of a one above a 10 bit count. It
+  // starts from the counts of the history, and the weights from 0.3.
+  void initMaps(){
+    mMaps.resize(Contexts * 256);
+    for(unsigned k = 0; k < Contexts; ++k){
+      for(unsigned state = 0; state < 256; ++state){
+        std::uint32_t n0 = BitHistory::zeros(state), n1 = BitHistory::ones(state);
+        std::uint32_t p = ((2 * n1 + 1) << 22) / (2 * (n0 + n1) + 2);
+        mMaps[k * 256 + state] = p << 10;
+      }
+    }
+    mWeights.fill(FixedPoint20(0.3));
+  }
+
+  // Mixes the maps of the histories in mSlots
+  std::uint32_t mix(){
+    StretchTable const& stretch = StretchTable::get();
+    FixedPoint20 const* weights = &mWeights[mBit * Contexts];
+    FixedPoint20 sum;
+    for(unsigned k = 0; k < Contexts; ++k){
+      mInputs[k] = stretch.stretch(mMaps[k * 256 + mStates[mSlots[k]]]);
+      sum += weights[k] * mInputs[k];
+    }
+    mResult = SquashTable::get().squash(sum);
+    return mResult.value() << 12;
+  }
+
+  // Trains the mix and the maps, then moves each history on
+  void train(bool b){
+    std::array<std::int32_t, 1024> const& rates = reciprocals();
+    FixedPoint20* weights = &mWeights[mBit * Contexts];
+    FixedPoint20 error = mRate * ((b ? FixedPoint20::Unit() : FixedPoint20()) - mResult);
+    BitHistory const& history = BitHistory::get();
+    for(unsigned k = 0; k < Contexts; ++k){
+      weights[k] += error * mInputs[k];
+      std::uint8_t& state = mStates[mSlots[k]];
+      std::uint32_t& entry = mMaps[k * 256 + state];
+      std::uint32_t count = entry & 1023;
+      std::int32_t p = entry >> 10;
+      std::int64_t step = std::int64_t(((b ? 1 << 22 : 0) - p) >> 3) * rates[count];
+      entry = (entry & ~1023u) + (static_cast<std::uint32_t>(step) & ~1023u) + (count < Limit ? count + 1 : count);
+      state = history.next(state, b);
+    }
+  }
+
+  // 2^13 / (count + 1.5), the step of a count with the error over 8 moves
+  // the probability by error / (count + 1.5)
+  static std::array<std::int32_t, 1024> const& reciprocals(){
+    static std::array<std::int32_t, 1024> const table = [](){
+      std::array<std::int32_t, 1024> t;
+      for(std::int32_t i = 0; i < 1024; ++i) t[i] = 16384 / (2 * i + 3);
+      return t;
+    }();
+    return table;
+  }
+
+  // Byte at a time, the contexts are hashed once per byte as in RNAModel
+  template<typename Code>
+  void codeByte(Code code){
+    std::array<std::uint32_t, Contexts> bases;
+    mContext.byteBases(bases);
+    for(unsigned i = 0; i < 8; ++i){
+      mContext.bitSlots(bases, mSlots);
+      bool bit = code(mix(), i);
+      train(bit);
+      mContext.update(bit);
+      mBit = (mBit + 1) & 7;
+    }
+  }
+
+  Ctx mContext;
+  Table<std::uint8_t> mStates;
+  std::vector<std::uint32_t> mMaps;
+  std::array<FixedPoint20, 8 * Contexts> mWeights;
+  FixedPoint20 mRate;
+  unsigned mBit;
+
+  // --- Current bit ---
+  std::array<std::uint32_t, Contexts> mSlots;
+  std::array<FixedPoint20, Contexts> mInputs;
+  FixedPoint20 mResult;
+};
+
+template<typename Ctx>
+constexpr double IndirectModel<Ctx>::DefaultRate;
+template<typename Ctx>
+constexpr unsigned IndirectModel<Ctx>::Limit;
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// --- JobScheduler ---
+// Runs independent jobs on a pool of worker threads, with at most budget
+// bytes of memory announced by the running jobs. Jobs start largest first,
+// so that the longest one does not start last : a free worker takes the
+// largest waiting job that fits in what is left of the budget, and a job
+// over the whole budget runs alone.
+
+class JobScheduler {
+public:
+  struct Job {
+    std::string name;
+    std::uint64_t size;   // Bytes processed, for the order and the throughput
+    std::uint64_t memory; // Bytes held while running
+    std::function<bool()> run;
+  };
+
+  JobScheduler(unsigned workers, std::uint64_t budget) :
+  mWorkers(std::max(workers, 1u)), mBudget(budget), mUsed(0), mRunning(0), mFailed(0){ }
+
+  void add(Job job){
+    mJobs.push_back(std::move(job));
+  }
+
+  // Runs every job, false if one failed
+  bool run(){
+    std::stable_sort(mJobs.begin(), mJobs.end(), [](Job const& a, Job const& b){
+      return a.size > b.size;
+    });
+    mStart = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for(unsigned i = 0; i < std::min<std::size_t>(mWorkers, mJobs.size()); ++i){
+      workers.emplace_back(&JobScheduler::work, this);
+    }
+    for(std::thread& worker : workers) worker.join();
+
+    std::uint64_t total = 0;
+    for(Job const& job : mJobs) total += job.size;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - mStart;
+    std::cout << "Jobs : " << mJobs.size() << ", " << mFailed << " failed, " << total << " bytes in "
+      << elapsed.count() << " s, " << (elapsed.count() > 0 ? total / elapsed.count() / 1e6 : 0.0) << " MB/s" << std::endl;
+    return mFailed == 0;
+  }
+
+private:
+  void work(){
+    std::unique_lock<std::mutex> lock(mMutex);
+    for(;;){
+      Job* job = nullptr;
+      mChanged.wait(lock, [&](){
+        job = next();
+        return job != nullptr || mNext == mJobs.size();
+      });
+      if(!job) return;
+      mUsed += job->memory;
+      mRunning++;
+      lock.unlock();
+
+      auto start = std::chrono::steady_clock::now();
+      bool ok = job->run();
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+      lock.lock();
+      mUsed -= job->memory;
+      mRunning--;
+      mFailed += !ok;
+      std::cout << "Done " << job->name << " : " << job->size << " bytes, " << elapsed.count() << " s"
+        << (ok ? "" : ", FAILED") << std::endl;
+      mChanged.notify_all();
+    }
+  }
+
+  // Largest waiting job that fits, taken out of the waiting ones. Jobs before
+  // mNext are started, the others wait in size order except the ones swapped
+  // ahead of them.
+  Job* next(){
+    for(std::size_t i = mNext; i < mJobs.size(); ++i){
+      Job& job = mJobs[i];
+      if(mUsed + job.memory <= mBudget || mRunning == 0){
+        std::rotate(mJobs.begin() + mNext, mJobs.begin() + i, mJobs.begin() + i + 1);
+        return &mJobs[mNext++];
+      }
+    }
+    return nullptr;
+  }
+
+  std::vector<Job> mJobs;
+  std::size_t mNext = 0;
+  unsigned mWorkers;
+  std::uint64_t mBudget, mUsed;
+  unsigned mRunning, mFailed;
+  std::chrono::steady_clock::time_point mStart;
+
+  std::mutex mMutex;
+  std::condition_variable mChanged;
+};
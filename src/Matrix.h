@@ -1,10 +1,19 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstdlib>
+#include <memory>
 #include <vector>
-#include <functional>
 #include <iostream>
 
+#include "Snapshot.h"
+
+// --- Matrix ---
+// Dynamic shapes, for setup and tools. Per bit code uses the static shapes
+// below.
+
 template<typename T>
 class Matrix{
 public:
@@ -15,7 +24,8 @@ public:
     mHeight(h), 
     mData(w * h){ }
 
-  Matrix(unsigned w, unsigned h, std::function<T(unsigned, unsigned)> const& init) :
+  template<typename Init>
+  Matrix(unsigned w, unsigned h, Init init) :
     mWidth(w),
     mHeight(h), 
     mData(w * h){
@@ -34,7 +44,8 @@ public:
     }
   }
 
-  void init(std::function<T(unsigned, unsigned)> const& init){
+  template<typename Init>
+  void init(Init init){
     for(unsigned i = 0; i < mHeight; ++i){
       for(unsigned j = 0; j < mWidth; ++j){
         mData[i * mWidth + j] = init(i, j);
@@ -51,6 +62,19 @@ public:
   unsigned width() const { return mWidth; }
   unsigned height() const { return mHeight; }
 
+  void save(SnapshotWriter& writer) const {
+    writer.value(mWidth);
+    writer.value(mHeight);
+    writer.array(mData.data(), mData.size());
+  }
+
+  bool restore(SnapshotReader& reader){
+    unsigned w = 0, h = 0;
+    reader.value(w);
+    reader.value(h);
+    return w == mWidth && h == mHeight && reader.copyArray(mData.data(), mData.size());
+  }
+
   // Index access
 
   T const& at(unsigned i, unsigned j) const { assert(i < mHeight && j < mWidth); return mData[i * mWidth + j]; }
@@ -73,7 +97,7 @@ public:
   void operator-=(Matrix<T> const& other){
     for(unsigned i = 0; i < mHeight; ++i){
       for(unsigned j = 0; j < mWidth; ++j){
-        at(i, j) += other.at(i, j);
+        at(i, j) -= other.at(i, j);
       }
     }
   }
@@ -102,7 +126,8 @@ public:
 
   // Others
 
-  void apply(std::function<T(unsigned, unsigned, T)> const& func){
+  template<typename Func>
+  void apply(Func func){
     for(unsigned i = 0; i < mHeight; ++i){
       for(unsigned j = 0; j < mWidth; ++j){
         at(i, j) = func(i, j, at(i, j));
@@ -114,3 +139,136 @@ private:
   unsigned mWidth, mHeight;
   std::vector<T> mData;
 };
+
+// --- AlignedArray ---
+// N zeroed values, aligned for vector loads. Small arrays live inside their
+// owner, on the 16 bytes new guarantees before C++17 so that models can
+// still be allocated with it, large ones on the heap, allocated once on
+// cache line boundaries.
+
+template<typename T, std::size_t N, bool Inline = (N * sizeof(T) <= 4096)>
+class AlignedArray {
+public:
+  AlignedArray(){ fill(T()); }
+
+  std::size_t size() const { return N; }
+  T* data(){ return mData.data(); }
+  T const* data() const { return mData.data(); }
+  T& operator[](std::size_t i){ assert(i < N); return mData[i]; }
+  T const& operator[](std::size_t i) const { assert(i < N); return mData[i]; }
+
+  void fill(T const& value){ std::fill(mData.begin(), mData.end(), value); }
+
+private:
+  alignas(16) std::array<T, N> mData;
+};
+
+template<typename T, std::size_t N>
+class AlignedArray<T, N, false> {
+public:
+  AlignedArray(){
+    void* data = nullptr;
+    int failed = posix_memalign(&data, 64, N * sizeof(T));
+    assert(!failed);
+    (void) failed;
+    mData.reset(static_cast<T*>(data));
+    fill(T());
+  }
+
+  std::size_t size() const { return N; }
+  T* data(){ return mData.get(); }
+  T const* data() const { return mData.get(); }
+  T& operator[](std::size_t i){ assert(i < N); return mData[i]; }
+  T const& operator[](std::size_t i) const { assert(i < N); return mData[i]; }
+
+  void fill(T const& value){ std::fill(mData.get(), mData.get() + N, value); }
+
+private:
+  struct Free {
+    void operator()(T* p) const { std::free(p); }
+  };
+  std::unique_ptr<T[], Free> mData;
+};
+
+// --- LayerShapes ---
+// Shapes of a network known at compile time, Sizes being its input size then
+// the output size of each layer. All the weights live in one block and all
+// the outputs in another : Layer<L, Shapes> is an Out x In row major matrix
+// at WeightOffset in the first, its outputs at UnitOffset in the second.
+
+template<unsigned... Sizes>
+struct LayerShapes;
+
+template<unsigned In>
+struct LayerShapes<In> {
+  static constexpr unsigned Layers = 0;
+  static constexpr unsigned Weights = 0;
+  static constexpr unsigned Units = 0;
+};
+
+template<unsigned In, unsigned Out, unsigned... Sizes>
+struct LayerShapes<In, Out, Sizes...> {
+  using Next = LayerShapes<Out, Sizes...>;
+  static constexpr unsigned Layers = 1 + Next::Layers;
+  static constexpr unsigned Weights = In * Out + Next::Weights;
+  static constexpr unsigned Units = Out + Next::Units;
+};
+
+template<unsigned L, typename Shapes>
+struct Layer;
+
+template<unsigned In0, unsigned Out0, unsigned... Sizes>
+struct Layer<0, LayerShapes<In0, Out0, Sizes...>> {
+  static constexpr unsigned In = In0;
+  static constexpr unsigned Out = Out0;
+  static constexpr unsigned WeightOffset = 0;
+  static constexpr unsigned UnitOffset = 0;
+};
+
+template<unsigned L, unsigned In0, unsigned Out0, unsigned... Sizes>
+struct Layer<L, LayerShapes<In0, Out0, Sizes...>> {
+  using Next = Layer<L - 1, LayerShapes<Out0, Sizes...>>;
+  static constexpr unsigned In = Next::In;
+  static constexpr unsigned Out = Next::Out;
+  static constexpr unsigned WeightOffset = In0 * Out0 + Next::WeightOffset;
+  static constexpr unsigned UnitOffset = Out0 + Next::UnitOffset;
+};
+
+// --- Fused kernels ---
+// Over H x W row major matrices with compile time shapes, callbacks are
+// template arguments so that they inline. Sums run over increasing indices,
+// like Matrix::operator*.
+
+// out[i] = f(i, sum over k of m(i, k) * in[k])
+template<unsigned H, unsigned W, typename T, typename F>
+inline void multiplyApply(T const* m, T const* in, T* out, F f){
+  for(unsigned i = 0; i < H; ++i){
+    T sum = T();
+    for(unsigned k = 0; k < W; ++k){
+      sum += m[i * W + k] * in[k];
+    }
+    out[i] = f(i, sum);
+  }
+}
+
+// out[j] = f(j, sum over k of m(k, j) * in[k]), the transposed product
+template<unsigned H, unsigned W, typename T, typename F>
+inline void multiplyTransposedApply(T const* m, T const* in, T* out, F f){
+  for(unsigned j = 0; j < W; ++j){
+    T sum = T();
+    for(unsigned k = 0; k < H; ++k){
+      sum += m[k * W + j] * in[k];
+    }
+    out[j] = f(j, sum);
+  }
+}
+
+// m(i, j) -= scale * a[i] * b[j], the outer product update of a layer
+template<unsigned H, unsigned W, typename T>
+inline void subtractOuter(T* m, T const* a, T const* b, T scale){
+  for(unsigned i = 0; i < H; ++i){
+    for(unsigned j = 0; j < W; ++j){
+      m[i * W + j] -= scale * a[i] * b[j];
+    }
+  }
+}
@@ -1,11 +1,28 @@
 #pragma once
 #include "Model.h"
+#include "SquashTable.h"
+#include "Pipeline.h"
+
+#include <memory>
+#include <thread>
 
 // --- MixModel ---
+// Logistic mix of the predictions of its models, with online weights.
+// In parallel mode every model but the first gets a worker thread and the
+// calling thread runs the first one. They meet at a spin barrier once per
+// bit : update() has each model learn the bit and predict the next one at
+// once, so that the latency of a bit is that of the slowest model rather
+// than the sum. The workers are pinned on their own processors when there
+// are enough of them, the calling thread is left where it is. Workers of an
+// idle model sleep at the barrier after a short spin. Predictions are the
+// same in both modes.
 
 class MixModel : public Model{
 public:
-  MixModel(std::vector<Model*> models, std::vector<FixedPoint24> weigths = {}, FixedPoint24 rate = FixedPoint24(0.006)) : 
+  // Converted by value, a header can't define it for every translation unit
+  static constexpr double DefaultRate = 0.006;
+
+  MixModel(std::vector<Model*> models, std::vector<FixedPoint24> weigths = {}, FixedPoint24 rate = FixedPoint24(DefaultRate)) : 
   mModels(std::move(models)),
   mModelPredictions(mModels.size()),
   mRate(rate){
@@ -14,6 +31,29 @@ public:
     } else {
       mWeights = weigths;
     }
+    mInitialWeights = mWeights;
+  }
+
+  virtual ~MixModel(){
+    setParallel(false);
+  }
+
+  void setParallel(bool parallel){
+    if(parallel == !mWorkers.empty() || mModels.size() < 2) return;
+    if(parallel){
+      mStart.reset(new SpinBarrier(mModels.size()));
+      mEnd.reset(new SpinBarrier(mModels.size()));
+      for(unsigned i = 1; i < mModels.size(); ++i){
+        mWorkers.emplace_back(&MixModel::work, this, i);
+        pinThread(mWorkers.back(), i, mModels.size());
+      }
+    }else{
+      mCommand = Stop;
+      mStart->wait();
+      for(std::thread& worker : mWorkers) worker.join();
+      mWorkers.clear();
+    }
+    mAhead = false;
   }
 
   FixedPoint24 stretch(std::uint32_t p){
@@ -22,40 +62,115 @@ public:
   }
 
   FixedPoint24 squash(FixedPoint24 p){
-    auto result = FixedPoint24::Unit() / (FixedPoint24::Unit() + (-p).exp());
-    if(result < FixedPoint24()){
-      return FixedPoint24();
-    }else{
-      return result;
-    }
+    return FixedPoint24::From(SquashTable::get().squash(FixedPoint20::From(p)));
   }
 
   virtual std::uint32_t predict() override{
-    std::uint64_t thisPred64 = 0;
     // --- Remember the predictions for the next update
+    if(mWorkers.empty()){
+      for(unsigned i = 0; i < mModels.size(); ++i){
+        mModelPredictions[i].stretched = stretch(mModels[i]->predict()); // 8 - 24 FixedPoint
+      }
+    }else if(!mAhead){
+      step(Predict);
+    }
+    mAhead = false;
+    std::uint64_t thisPred64 = 0;
     for(unsigned i = 0; i < mModels.size(); ++i){
-      mModelPredictions[i] = stretch(mModels[i]->predict()); // 8 - 24 FixedPoint
-      thisPred64 += static_cast<std::int64_t>(mModelPredictions[i].value()) * static_cast<std::int64_t>(mWeights[i].value()); // 16 - 48 FixedPoint
+      thisPred64 += static_cast<std::int64_t>(mModelPredictions[i].stretched.value()) * static_cast<std::int64_t>(mWeights[i].value()); // 16 - 48 FixedPoint
     }
     mLastPrediction = squash(FixedPoint24::FromValue(thisPred64 >> 24));
     return mLastPrediction.value() << 8;
   }
 
   virtual void update(bool nxt){
+    for(unsigned i = 0; i < mModels.size(); ++i){
+      // Saturated, a weight that wrapped would flip the sign of its model
+      FixedPoint24 error = (nxt ? FixedPoint24::Unit() : FixedPoint24()) - mLastPrediction;
+      mWeights[i] = mWeights[i].saturatingAdd(mRate.saturatingMul(mModelPredictions[i].stretched).saturatingMul(error));
+    }
+
+    if(mWorkers.empty()){
+      for(Model* model : mModels){
+        model->update(nxt);
+      }
+    }else{
+      mBit = nxt;
+      step(UpdatePredict);
+      mAhead = true;
+    }
+  }
+
+  virtual void reset() override {
     for(Model* model : mModels){
-      model->update(nxt);
+      model->reset();
     }
+    mWeights = mInitialWeights;
+    mAhead = false;
+  }
 
-    for(unsigned i = 0; i < mModels.size(); ++i){
-      mWeights[i] += mRate * mModelPredictions[i] * ((nxt ? FixedPoint24::Unit() : FixedPoint24()) - mLastPrediction);
+  virtual bool save(SnapshotWriter& writer) const override {
+    writer.section("MixModel");
+    writer.array(mWeights.data(), mWeights.size());
+    for(Model* model : mModels){
+      if(!model->save(writer)) return false;
+    }
+    return writer.good();
+  }
+
+  virtual bool restore(SnapshotReader& reader) override {
+    if(!reader.section("MixModel") || !reader.copyArray(mWeights.data(), mWeights.size())) return false;
+    mAhead = false;
+    for(Model* model : mModels){
+      if(!model->restore(reader)) return false;
     }
+    return true;
   }
 
 private:
+  enum Command { Predict, UpdatePredict, Stop };
+
+  // Runs command on every model, the first one on this thread
+  void step(Command command){
+    mCommand = command;
+    mStart->wait();
+    run(0);
+    mEnd->wait();
+  }
+
+  void run(unsigned i){
+    if(mCommand == UpdatePredict) mModels[i]->update(mBit);
+    mModelPredictions[i].stretched = stretch(mModels[i]->predict());
+  }
+
+  void work(unsigned i){
+    for(;;){
+      mStart->wait();
+      if(mCommand == Stop) return;
+      run(i);
+      mEnd->wait();
+    }
+  }
+
   std::vector<Model*> mModels;
-  std::vector<FixedPoint24> mWeights;
+  std::vector<FixedPoint24> mWeights, mInitialWeights;
   FixedPoint24 mRate;
 
-  std::vector<FixedPoint24> mModelPredictions;
+  // The prediction of each model sits on its own cache line, which the
+  // thread running the model writes every bit. Being 64 bytes apart, two of
+  // them never share a line, whatever the alignment of the vector.
+  struct Prediction {
+    FixedPoint24 stretched;
+    char pad[64 - sizeof(FixedPoint24)];
+  };
+  std::vector<Prediction> mModelPredictions;
   FixedPoint24 mLastPrediction;
+
+  // --- Parallel mode ---
+  std::vector<std::thread> mWorkers;
+  std::unique_ptr<SpinBarrier> mStart, mEnd;
+  Command mCommand = Predict;
+  bool mBit = false;
+  // The models already predicted the next bit
+  bool mAhead = false;
 };
\ No newline at end of file
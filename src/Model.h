@@ -9,9 +9,27 @@
 #include <array>
 #include <random>
 
+#include "Encoder.h"
+#include "Decoder.h"
 #include "FixedPoint.h"
 #include "Matrix.h"
 #include "CircularBuffer.h"
+#include "Table.h"
+#include "Snapshot.h"
+
+// --- Ratio ---
+// Fraction of an integer count, rounded down like count * n / d, so that a
+// count weighted by a setting stays deterministic
+
+struct Ratio {
+  std::uint32_t numerator, denominator;
+
+  std::uint64_t apply(std::uint64_t count) const {
+    return count * numerator / denominator;
+  }
+
+  double value() const { return static_cast<double>(numerator) / denominator; }
+};
 
 // --- Model ---
 
@@ -21,6 +39,53 @@ public:
 
   virtual std::uint32_t predict() = 0;
   virtual void update(bool nxt) = 0;
+
+  // Whole bytes, most significant bit first. The coder still codes bits, but a
+  // model can look its contexts up once per byte and skip the virtual calls.
+  virtual void encode(Encoder& encoder, unsigned char byte){
+    for(unsigned i = 0; i < 8; ++i){
+      bool bit = byte & (0x80 >> i);
+      encoder.encode(bit, predict());
+      update(bit);
+    }
+  }
+
+  virtual unsigned char decode(Decoder& decoder){
+    unsigned char byte = 0;
+    for(unsigned i = 0; i < 8; ++i){
+      bool bit = decoder.decode(predict());
+      byte |= bit << (7 - i);
+      update(bit);
+    }
+    return byte;
+  }
+
+  // Trains on byte like encode, but hands the eight predictions out instead
+  // of coding them, so that another thread can run the coder
+  virtual void predictByte(unsigned char byte, std::uint32_t* predictions){
+    for(unsigned i = 0; i < 8; ++i){
+      bool bit = byte & (0x80 >> i);
+      predictions[i] = predict();
+      update(bit);
+    }
+  }
+
+  // Trains on a byte nobody codes
+  virtual void learn(unsigned char byte){
+    for(unsigned i = 0; i < 8; ++i){
+      bool bit = byte & (0x80 >> i);
+      predict();
+      update(bit);
+    }
+  }
+
+  // Back to the state of a newly constructed model
+  virtual void reset() = 0;
+
+  // Full model state, both return false when the model does not support
+  // snapshots or the snapshot was written by another model
+  virtual bool save(SnapshotWriter&) const { return false; }
+  virtual bool restore(SnapshotReader&) { return false; }
 };
 
 // --- Model ---
@@ -36,6 +101,19 @@ public:
 
   virtual void update(bool) override{ }
 
+  virtual void reset() override{ }
+
+  virtual bool save(SnapshotWriter& writer) const override{
+    writer.section("ConstModel");
+    writer.value(mPrediction);
+    return writer.good();
+  }
+  virtual bool restore(SnapshotReader& reader) override{
+    reader.section("ConstModel");
+    reader.value(mPrediction);
+    return reader.good();
+  }
+
 private:
   std::uint32_t mPrediction;
 };
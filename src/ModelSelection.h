@@ -0,0 +1,194 @@
+#pragma once
+#include "Model.h"
+#include "RNAModel.h"
+#include "IndirectModel.h"
+
+#include <array>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+// --- Model types ---
+// The model graph used for an archive, recorded in its header with one
+// parameter (the record stride for ModelType::Records).
+
+enum class ModelType : std::uint8_t {
+  Large,   // RNAContext, orders 0 to 5, 256 MB of weights
+  Small,   // Orders 0 to 5, 17 MB of weights, for small inputs
+  Simple,  // Orders 0 to 2, 8 MB of weights, for low entropy inputs
+  Records, // Orders 0 to 3 and record contexts, for tables and bitmaps
+  Flat,    // No model, for incompressible inputs
+  Compact, // RNAContext with 16 bit weights, 128 MB
+  Indirect // RNAContext with 8 bit histories instead of weights, 64 MB
+};
+
+inline bool validModelType(std::uint8_t type){
+  return type <= static_cast<std::uint8_t>(ModelType::Indirect);
+}
+
+using SmallRNAContext = BasicRNAContext<5, 1048573>;
+using SimpleRNAContext = BasicRNAContext<2, 1048573>;
+using RecordsRNAContext = BasicRNAContext<3, 4194301, true>;
+
+// --- Tuned settings ---
+// Training rate of the model of each type, promoted from the tuner (mode u)
+// and fixed at compile time. A rate shapes every prediction of its type :
+// changing one takes a new archive version and new golden digests.
+constexpr double TunedRates[] = {
+  1.25, // Large
+  1.25, // Small
+  1.0,  // Simple
+  1.0,  // Records
+  0.0,  // Flat
+  1.25, // Compact
+  0.002 // Indirect, rate of its mix
+};
+
+inline double tunedRate(ModelType type){
+  return TunedRates[static_cast<unsigned>(type)];
+}
+
+// The model of the type with another training rate, for the tuner
+inline std::unique_ptr<Model> makeModel(ModelType type, std::uint32_t parameter, double rate){
+  FixedPoint20 const r(rate);
+  switch(type){
+  case ModelType::Large:
+    return std::unique_ptr<Model>(new RNAModel<RNAContext>(RNAContext(), r));
+  case ModelType::Small:
+    return std::unique_ptr<Model>(new RNAModel<SmallRNAContext>(SmallRNAContext(), r));
+  case ModelType::Simple:
+    return std::unique_ptr<Model>(new RNAModel<SimpleRNAContext>(SimpleRNAContext(), r));
+  case ModelType::Records:
+    // The stride comes from the header, keep the history buffer reasonable
+    parameter = std::min<std::uint32_t>(std::max<std::uint32_t>(parameter, 1), 1 << 16);
+    return std::unique_ptr<Model>(new RNAModel<RecordsRNAContext>(RecordsRNAContext(parameter), r));
+  case ModelType::Flat:
+    return std::unique_ptr<Model>(new ConstModel(1u << 31));
+  case ModelType::Compact:
+    return std::unique_ptr<Model>(new RNAModel<RNAContext, FixedPoint16>(RNAContext(), r));
+  case ModelType::Indirect:
+    return std::unique_ptr<Model>(new IndirectModel<RNAContext>(RNAContext(), r));
+  }
+  return nullptr;
+}
+
+inline std::unique_ptr<Model> makeModel(ModelType type, std::uint32_t parameter){
+  return makeModel(type, parameter, tunedRate(type));
+}
+
+// Bytes of weights a model of the type allocates
+inline std::uint64_t modelMemory(ModelType type){
+  switch(type){
+  case ModelType::Large:
+    return std::uint64_t(RNAContext::ContextSize) * sizeof(FixedPoint20);
+  case ModelType::Small:
+    return std::uint64_t(SmallRNAContext::ContextSize) * sizeof(FixedPoint20);
+  case ModelType::Simple:
+    return std::uint64_t(SimpleRNAContext::ContextSize) * sizeof(FixedPoint20);
+  case ModelType::Records:
+    return std::uint64_t(RecordsRNAContext::ContextSize) * sizeof(FixedPoint20);
+  case ModelType::Flat:
+    return 0;
+  case ModelType::Compact:
+    return std::uint64_t(RNAContext::ContextSize) * sizeof(FixedPoint16);
+  case ModelType::Indirect:
+    return std::uint64_t(RNAContext::ContextSize) * sizeof(std::uint8_t);
+  }
+  return 0;
+}
+
+inline std::string modelName(ModelType type){
+  static char const* const names [] = { "large", "small", "simple", "records", "flat", "compact", "indirect" };
+  return names[static_cast<unsigned>(type)];
+}
+
+inline bool parseModelType(std::string const& name, ModelType& type){
+  for(unsigned i = 0; validModelType(i); ++i){
+    if(name == modelName(static_cast<ModelType>(i))){
+      type = static_cast<ModelType>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// --- InputSampler ---
+// First pass over a sample of the input : byte histogram, order 0 entropy,
+// how often 4 byte strings repeat, and the record stride that best predicts
+// each byte from the byte one record back.
+
+class InputSampler {
+public:
+  static constexpr unsigned MaxStride = 1024;
+  static constexpr std::uint64_t SmallInput = 1 << 20;
+
+  InputSampler() : mHistogram(), mStrideMatches(MaxStride + 1), mSize(0), mRepeats(0), mStrings(0), mSeen(1 << 16){ }
+
+  // Samples are analysed separately, strides never span two samples
+  void sample(unsigned char const* data, std::size_t size){
+    std::uint32_t string = 0;
+    for(std::size_t i = 0; i < size; ++i){
+      mHistogram[data[i]]++;
+      string = (string << 8) | data[i];
+      if(i >= 3){
+        std::uint32_t hash = (string * 2654435761u) >> 16;
+        mRepeats += mSeen[hash] == string + 1;
+        mSeen[hash] = string + 1;
+        mStrings++;
+      }
+      for(unsigned d = 1; d <= MaxStride && d <= i; ++d){
+        mStrideMatches[d] += data[i] == data[i - d];
+      }
+    }
+    mSize += size;
+  }
+
+  // Bits per byte of an order 0 model
+  double entropy() const {
+    double result = 0.0;
+    for(std::uint64_t count : mHistogram){
+      if(count == 0) continue;
+      double p = static_cast<double>(count) / mSize;
+      result -= p * std::log2(p);
+    }
+    return result;
+  }
+
+  // Fraction of 4 byte strings already seen in the sample
+  double repeatRate() const {
+    return mStrings == 0 ? 0.0 : static_cast<double>(mRepeats) / mStrings;
+  }
+
+  // Record length whose byte one record back matches much more often than the
+  // previous byte does, 0 if none
+  unsigned stride() const {
+    unsigned best = 0;
+    for(unsigned d = 2; d <= MaxStride; ++d){
+      if(best == 0 || mStrideMatches[d] > mStrideMatches[best]) best = d;
+    }
+    std::uint64_t threshold = std::max<std::uint64_t>(mStrideMatches[1] * 3 / 2, mSize / 4);
+    return best != 0 && mStrideMatches[best] > threshold ? best : 0;
+  }
+
+  std::array<std::uint64_t, 256> const& histogram() const { return mHistogram; }
+
+  ModelType choose(std::uint64_t inputSize, std::uint32_t& parameter) const {
+    parameter = 0;
+    if(mSize == 0) return ModelType::Small;
+    if(entropy() > 7.9 && repeatRate() < 0.01) return ModelType::Flat;
+    unsigned s = stride();
+    if(s != 0){
+      parameter = s;
+      return ModelType::Records;
+    }
+    if(entropy() < 2.0) return ModelType::Simple;
+    return inputSize <= SmallInput ? ModelType::Small : ModelType::Large;
+  }
+
+private:
+  std::array<std::uint64_t, 256> mHistogram;
+  std::vector<std::uint64_t> mStrideMatches;
+  std::uint64_t mSize, mRepeats, mStrings;
+  std::vector<std::uint32_t> mSeen;
+};
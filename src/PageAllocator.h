@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// --- PageAllocator ---
+// Zeroed memory for the model tables. Hashed contexts touch a new page on
+// nearly every lookup, so with small pages they miss the TLB about as often :
+// tables of a few huge pages or more are mapped on explicit huge pages
+// (MAP_HUGETLB) when the system has some reserved, and otherwise on a mapping
+// aligned on huge pages and advised for transparent ones (MADV_HUGEPAGE),
+// which the system backs with huge pages when it can. Smaller tables come
+// from calloc. The mappings are tracked so that report() tells the pages the
+// system actually gave.
+
+enum class PageKind {
+  Small,       // Huge pages turned off
+  Transparent, // Advised, maybe backed by huge pages
+  Explicit     // Reserved huge pages
+};
+
+class PageAllocator {
+public:
+  static constexpr std::size_t HugePage = 2 << 20;
+
+  // Off, the next tables are mapped on small pages, for comparisons
+  static void setHugePages(bool enabled){
+    std::lock_guard<std::mutex> lock(instance().mMutex);
+    instance().mHuge = enabled;
+  }
+
+  // Zeroed memory, freed with its last owner. resetPage is the granularity
+  // at which pages of the memory can be given back.
+  static std::shared_ptr<void> allocate(std::size_t bytes, std::size_t& resetPage){
+    return instance().map(bytes, resetPage);
+  }
+
+  // One line per mapped table
+  static std::string report(){
+    return instance().describe();
+  }
+
+private:
+  struct Mapping {
+    char* data;
+    std::size_t size;
+    PageKind kind;
+  };
+
+  // Never destroyed, tables may outlive static objects
+  static PageAllocator& instance(){
+    static PageAllocator* allocator = new PageAllocator();
+    return *allocator;
+  }
+
+  PageAllocator() : mHuge(true){ }
+
+  std::shared_ptr<void> map(std::size_t bytes, std::size_t& resetPage){
+    resetPage = sysconf(_SC_PAGESIZE);
+    if(bytes < 4 * HugePage){
+      void* data = std::calloc(bytes, 1);
+      assert(data != nullptr || bytes == 0);
+      return std::shared_ptr<void>(data, std::free);
+    }
+    bool huge;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      huge = mHuge;
+    }
+    std::size_t size = (bytes + HugePage - 1) & ~(HugePage - 1);
+    PageKind kind = PageKind::Small;
+    void* data = MAP_FAILED;
+    if(huge){
+      data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      kind = PageKind::Explicit;
+    }
+    if(data == MAP_FAILED){
+      // One more huge page, to cut an aligned mapping out of it
+      void* raw = mmap(nullptr, size + HugePage, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(raw == MAP_FAILED){
+        void* fallback = std::calloc(bytes, 1);
+        assert(fallback != nullptr);
+        return std::shared_ptr<void>(fallback, std::free);
+      }
+      char* begin = static_cast<char*>(raw);
+      char* aligned = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(begin) + HugePage - 1) & ~(HugePage - 1));
+      if(aligned != begin) munmap(begin, aligned - begin);
+      if(begin + HugePage != aligned) munmap(aligned + size, begin + HugePage - aligned);
+      data = aligned;
+      kind = huge && madvise(data, size, MADV_HUGEPAGE) == 0 ? PageKind::Transparent : PageKind::Small;
+      if(!huge) madvise(data, size, MADV_NOHUGEPAGE);
+    }
+    if(kind != PageKind::Small) resetPage = HugePage;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mMappings.push_back(Mapping{ static_cast<char*>(data), size, kind });
+    }
+    return std::shared_ptr<void>(data, [size](void* p){
+      instance().unmap(static_cast<char*>(p), size);
+    });
+  }
+
+  void unmap(char* data, std::size_t size){
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mMappings.erase(std::remove_if(mMappings.begin(), mMappings.end(), [&](Mapping const& m){ return m.data == data; }), mMappings.end());
+    }
+    munmap(data, size);
+  }
+
+  std::string describe(){
+    std::vector<Mapping> mappings;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mappings = mMappings;
+    }
+    std::ostringstream out;
+    for(Mapping const& mapping : mappings){
+      out << (mapping.size >> 20) << " MB table : ";
+      if(mapping.kind == PageKind::Explicit){
+        out << (HugePage >> 10) << " KB explicit pages";
+      }else{
+        std::uint64_t resident = 0, huge = 0;
+        residency(mapping, resident, huge);
+        out << (mapping.kind == PageKind::Transparent ? "transparent huge pages asked, " : "small pages, ")
+          << (resident >> 10) << " KB resident, " << (huge >> 10) << " KB of it on " << (HugePage >> 10) << " KB pages";
+      }
+      out << "\n";
+    }
+    return out.str();
+  }
+
+  // Resident bytes of the mapping, and how many of them are on huge pages,
+  // from /proc/self/smaps. Both stay 0 where it is not available.
+  static void residency(Mapping const& mapping, std::uint64_t& resident, std::uint64_t& huge){
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool inside = false;
+    std::uintptr_t first = reinterpret_cast<std::uintptr_t>(mapping.data);
+    std::uintptr_t last = first + mapping.size;
+    while(std::getline(smaps, line)){
+      std::size_t dash = line.find('-');
+      std::size_t space = line.find(' ');
+      if(dash != std::string::npos && space != std::string::npos && dash < space && line.find(':') > space){
+        std::uintptr_t start = std::stoull(line.substr(0, dash), nullptr, 16);
+        std::uintptr_t end = std::stoull(line.substr(dash + 1, space - dash - 1), nullptr, 16);
+        inside = start < last && first < end;
+        continue;
+      }
+      if(!inside) continue;
+      std::istringstream fields(line);
+      std::string key;
+      std::uint64_t kilobytes = 0;
+      fields >> key >> kilobytes;
+      if(key == "Rss:") resident += kilobytes << 10;
+      if(key == "AnonHugePages:") huge += kilobytes << 10;
+    }
+  }
+
+  std::mutex mMutex;
+  bool mHuge;
+  std::vector<Mapping> mMappings;
+};
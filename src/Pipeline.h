@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "CircularBuffer.h"
+
+// Waiting policy of the threads below : spins first, since the other side is
+// usually about to arrive, then yields, then sleeps, since it may also keep
+// the waiting side idle for a long time
+inline void backoff(unsigned& spins){
+  spins++;
+  if(spins < 1024) return;
+  if(spins < 2048){
+    std::this_thread::yield();
+  }else{
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+}
+
+// Waiting policy of a barrier : the threads meet once per bit, a few hundred
+// nanoseconds apart, so sleeping at every meeting would cost more than the
+// work between two meetings. Spins, then yields, which lets another thread
+// of the core run when there are more threads than cores. False once the
+// wait has lasted long enough that the other side is idle rather than busy,
+// the waiting side should then sleep.
+inline bool spin(unsigned& spins){
+  if(++spins < 1024) return true;
+  std::this_thread::yield();
+  return spins < 4096;
+}
+
+// Pins thread on the index-th processor this process may run on, so that a
+// thread spinning at a barrier keeps its core and its caches. Only when there
+// are at least count such processors, since pinned threads sharing one would
+// wait for each other's time slices. False when the thread is left to the
+// scheduler, as it is without pinning.
+inline bool pinThread(std::thread& thread, unsigned index, unsigned count){
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return false;
+  if(static_cast<unsigned>(CPU_COUNT(&allowed)) < count) return false;
+  cpu_set_t one;
+  CPU_ZERO(&one);
+  for(unsigned cpu = 0, seen = 0; cpu < CPU_SETSIZE; ++cpu){
+    if(!CPU_ISSET(cpu, &allowed)) continue;
+    if(seen++ == index){
+      CPU_SET(cpu, &one);
+      break;
+    }
+  }
+  return pthread_setaffinity_np(thread.native_handle(), sizeof(one), &one) == 0;
+}
+
+// --- SPSCRing ---
+// Lock free queue between exactly one producer thread and one consumer
+// thread. Each side owns one index and only reads the other, with acquire /
+// release ordering. The indices sit on their own cache lines, and each side
+// keeps a stale copy of the other index, so the shared lines are only read
+// when the ring looks full or empty.
+
+template<typename T>
+class SPSCRing {
+public:
+  SPSCRing(unsigned capacity) :
+  mSlots(circularStorage(capacity)), mMask(mSlots.size() - 1),
+  mHead(0), mTailCache(0), mTail(0), mHeadCache(0){ }
+
+  SPSCRing(SPSCRing const&) = delete;
+  SPSCRing& operator=(SPSCRing const&) = delete;
+
+  // --- Producer side ---
+
+  // Moves value in, unless the ring is full
+  bool tryPush(T& value){
+    std::uint64_t head = mHead.load(std::memory_order_relaxed);
+    if(head - mTailCache == mSlots.size()){
+      mTailCache = mTail.load(std::memory_order_acquire);
+      if(head - mTailCache == mSlots.size()) return false;
+    }
+    mSlots[head & mMask] = std::move(value);
+    mHead.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  void push(T value){
+    for(unsigned spins = 0; !tryPush(value);) backoff(spins);
+  }
+
+  // Copies count values in, waiting for room, publishing as it goes
+  void write(T const* data, std::size_t count){
+    std::uint64_t head = mHead.load(std::memory_order_relaxed);
+    for(unsigned spins = 0; count > 0;){
+      std::uint64_t room = mSlots.size() - (head - mTailCache);
+      if(room == 0){
+        mTailCache = mTail.load(std::memory_order_acquire);
+        room = mSlots.size() - (head - mTailCache);
+        if(room == 0){
+          backoff(spins);
+          continue;
+        }
+      }
+      spins = 0;
+      std::uint64_t n = std::min<std::uint64_t>(room, count);
+      for(std::uint64_t i = 0; i < n; ++i){
+        mSlots[(head + i) & mMask] = data[i];
+      }
+      head += n;
+      data += n;
+      count -= n;
+      mHead.store(head, std::memory_order_release);
+    }
+  }
+
+  // --- Consumer side ---
+
+  // Moves the oldest value out, unless the ring is empty
+  bool tryPop(T& value){
+    std::uint64_t tail = mTail.load(std::memory_order_relaxed);
+    if(tail == mHeadCache){
+      mHeadCache = mHead.load(std::memory_order_acquire);
+      if(tail == mHeadCache) return false;
+    }
+    value = std::move(mSlots[tail & mMask]);
+    mTail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  T pop(){
+    T value;
+    for(unsigned spins = 0; !tryPop(value);) backoff(spins);
+    return value;
+  }
+
+  // Copies the count oldest values out, waiting for them
+  void read(T* data, std::size_t count){
+    std::uint64_t tail = mTail.load(std::memory_order_relaxed);
+    for(unsigned spins = 0; count > 0;){
+      if(tail == mHeadCache){
+        mHeadCache = mHead.load(std::memory_order_acquire);
+        if(tail == mHeadCache){
+          backoff(spins);
+          continue;
+        }
+      }
+      spins = 0;
+      std::uint64_t n = std::min<std::uint64_t>(mHeadCache - tail, count);
+      for(std::uint64_t i = 0; i < n; ++i){
+        data[i] = mSlots[(tail + i) & mMask];
+      }
+      tail += n;
+      data += n;
+      count -= n;
+      mTail.store(tail, std::memory_order_release);
+    }
+  }
+
+private:
+  std::vector<T> mSlots;
+  std::uint64_t const mMask;
+  char mPad0[64];
+  // Producer line
+  std::atomic<std::uint64_t> mHead;
+  std::uint64_t mTailCache;
+  char mPad1[64];
+  // Consumer line
+  std::atomic<std::uint64_t> mTail;
+  std::uint64_t mHeadCache;
+  char mPad2[64];
+};
+
+// --- SpinBarrier ---
+// Meeting point of count threads, reusable right away : the last one to
+// arrive releases the others by moving to the next generation. Everything a
+// thread wrote before wait() is visible to the others after it. Waiting
+// spins, see spin(), then sleeps on a condition variable, so that threads
+// left waiting while their owner is idle give their cores back. The last
+// thread only takes the lock when some thread sleeps.
+
+class SpinBarrier {
+public:
+  SpinBarrier(unsigned count) : mCount(count), mArrived(0), mGeneration(0), mSleepers(0){ }
+
+  SpinBarrier(SpinBarrier const&) = delete;
+  SpinBarrier& operator=(SpinBarrier const&) = delete;
+
+  void wait(){
+    unsigned generation = mGeneration.load(std::memory_order_acquire);
+    if(mArrived.fetch_add(1, std::memory_order_acq_rel) + 1 == mCount){
+      mArrived.store(0, std::memory_order_relaxed);
+      // Sequentially consistent with the sleepers' count, so that either
+      // the sleeper sees the generation or this thread sees the sleeper
+      mGeneration.store(generation + 1, std::memory_order_seq_cst);
+      if(mSleepers.load(std::memory_order_seq_cst) != 0){
+        std::lock_guard<std::mutex> lock(mMutex);
+        mWake.notify_all();
+      }
+      return;
+    }
+    for(unsigned spins = 0; mGeneration.load(std::memory_order_acquire) == generation;){
+      if(spin(spins)) continue;
+      std::unique_lock<std::mutex> lock(mMutex);
+      mSleepers.fetch_add(1, std::memory_order_seq_cst);
+      while(mGeneration.load(std::memory_order_seq_cst) == generation) mWake.wait(lock);
+      mSleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+private:
+  unsigned const mCount;
+  std::atomic<unsigned> mArrived;
+  char mPad[64];
+  std::atomic<unsigned> mGeneration;
+  std::atomic<unsigned> mSleepers;
+  std::mutex mMutex;
+  std::condition_variable mWake;
+};
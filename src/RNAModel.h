@@ -1,65 +1,109 @@
 #pragma once
+
+#include <functional>
+
 #include "Model.h"
+#include "SquashTable.h"
 
 // --- Rna model ---
 
-class RNAContext {
+// Orders 0 and 1 have their own slots, each higher order up to MaxOrder is
+// hashed into HashSize slots. Record contexts add two hashed contexts using
+// the byte one record (stride bytes) back, alone and with the last byte.
+template<unsigned MaxOrder, unsigned HashSize, bool Records = false>
+class BasicRNAContext {
+  static_assert(2 <= MaxOrder && MaxOrder <= 7, "");
 public:
-  static constexpr unsigned ContextSize = 67174647;
+  static constexpr unsigned HashedContexts = MaxOrder - 1 + (Records ? 2 : 0);
+  static constexpr unsigned ContextSize = 65791 + HashedContexts * HashSize;
+  static constexpr unsigned Contexts = 2 + HashedContexts;
+  static_assert(HashSize >= 256, "");
 
-  RNAContext() : mCharPos(0), mCurrentChar(0), mBuffer(4) { }
+  BasicRNAContext(unsigned stride = 1) :
+  mCharPos(0), mCurrentChar(0), mStride(stride), mBuffer(std::max(MaxOrder, stride)) {
+    assert(stride >= 1);
+  }
 
   void iterateOnContext(std::function<void(unsigned)> const& f){
-    static const unsigned pow2 [] = {
-      1, 2, 4, 8, 16, 32, 64, 128
-    };
     // 0 -> 0 Always on
     // Note : does not improve compression
     // f(0);
     // 1 -> 255 Current char
-    unsigned currentCharContext = pow2[mCharPos] + mCurrentChar;
-    assert(1 <= currentCharContext && currentCharContext <= 255);
-    f(currentCharContext);
+    std::uint64_t partial = (1u << mCharPos) + mCurrentChar - 1;
+    f(1 + partial);
     // 256 -> 65790 Last char
-    unsigned lastCharContext = 255 + 256 * mBuffer[mBuffer.size() - 1] + pow2[mCharPos] + mCurrentChar;
-    assert(256 <= lastCharContext && lastCharContext <= 65790);
-    f(lastCharContext);
-    // 0 -> 16777214
-    unsigned long last2CharContext = 256 * 256 * mBuffer[mBuffer.size() - 2] +
-      256 * mBuffer[mBuffer.size() - 1] +
-      pow2[mCharPos] + mCurrentChar - 1;
-    // 65791 -> 16843005
-    unsigned last2CharContextHash = 65791 + last2CharContext % 16777214;
-    f(last2CharContextHash);
-    // 0 -> 4294967296
-    unsigned long last3CharContext =
-      256 * 256 * 256 * mBuffer[mBuffer.size() - 3] +
-      256 * 256 * mBuffer[mBuffer.size() - 2] +
-      256 * mBuffer[mBuffer.size() - 1] +
-      pow2[mCharPos] + mCurrentChar - 1;
-    // 16843006 -> 33620219
-    unsigned last3CharContextHash = 16843006 + last3CharContext % 16777214;
-    f(last3CharContextHash);
-    // 0 -> 1099511627776
-    unsigned long last4CharContext =
-      256 * 256 * 256 * 256 * mBuffer[mBuffer.size() - 4] +
-      256 * 256 * 256 * mBuffer[mBuffer.size() - 3] +
-      256 * 256 * mBuffer[mBuffer.size() - 2] +
-      256 * mBuffer[mBuffer.size() - 1] +
-      pow2[mCharPos] + mCurrentChar - 1;
-    // 33620219 -> 50397433
-    unsigned last4CharContextHash = 33620219 + last4CharContext % 16777214;
-    f(last4CharContextHash);
-    unsigned long last5CharContext =
-      256 * 256 * 256 * 256 * 256 * mBuffer[mBuffer.size() - 5] +
-      256 * 256 * 256 * 256 * mBuffer[mBuffer.size() - 4] +
-      256 * 256 * 256 * mBuffer[mBuffer.size() - 3] +
-      256 * 256 * mBuffer[mBuffer.size() - 2] +
-      256 * mBuffer[mBuffer.size() - 1] +
-      pow2[mCharPos] + mCurrentChar - 1;
-    // 50397433 -> 67174647
-    unsigned last5CharContextHash = 50397433 + last5CharContext % 16777214;
-    f(last5CharContextHash);
+    unsigned char const* last = mBuffer.window(MaxOrder) + MaxOrder;
+    std::uint64_t context = partial + (static_cast<std::uint64_t>(last[-1]) << 8);
+    f(256 + context);
+    // 65791 -> ContextSize Last k chars, hashed
+    unsigned offset = 65791;
+    for(unsigned k = 2; k <= MaxOrder; ++k){
+      context += static_cast<std::uint64_t>(last[-static_cast<int>(k)]) << (8 * k);
+      f(offset + context % HashSize);
+      offset += HashSize;
+    }
+    if(Records){
+      std::uint64_t above = byteAbove();
+      f(offset + ((above << 8) + partial) % HashSize);
+      offset += HashSize;
+      std::uint64_t aboveAndLast = (above << 8) + last[-1];
+      f(offset + ((aboveAndLast << 8) + partial) % HashSize);
+    }
+  }
+
+  // Same slots as iterateOnContext, split in a part hashed once per byte and
+  // the bits of the current byte, see bitSlots
+  void byteBases(std::array<std::uint32_t, Contexts>& bases) const {
+    assert(mCharPos == 0);
+    bases[0] = 1;
+    unsigned char const* last = mBuffer.window(MaxOrder) + MaxOrder;
+    std::uint64_t context = static_cast<std::uint64_t>(last[-1]) << 8;
+    bases[1] = 256 + context;
+    unsigned offset = 65791;
+    for(unsigned k = 2; k <= MaxOrder; ++k){
+      context += static_cast<std::uint64_t>(last[-static_cast<int>(k)]) << (8 * k);
+      bases[k] = offset + context % HashSize;
+      offset += HashSize;
+    }
+    if(Records){
+      std::uint64_t above = byteAbove();
+      bases[MaxOrder + 1] = offset + (above << 8) % HashSize;
+      offset += HashSize;
+      std::uint64_t aboveAndLast = (above << 8) + last[-1];
+      bases[MaxOrder + 2] = offset + (aboveAndLast << 8) % HashSize;
+    }
+  }
+
+  // The byte part of a hashed context is a multiple of 256, so adding the bits
+  // to its hash goes past the end at most once
+  void bitSlots(std::array<std::uint32_t, Contexts> const& bases, std::array<std::uint32_t, Contexts>& slots) const {
+    unsigned partial = (1u << mCharPos) + mCurrentChar - 1;
+    slots[0] = bases[0] + partial;
+    slots[1] = bases[1] + partial;
+    unsigned end = 65791;
+    for(unsigned k = 2; k < Contexts; ++k){
+      end += HashSize;
+      slots[k] = bases[k] + partial;
+      if(slots[k] >= end) slots[k] -= HashSize;
+    }
+  }
+
+  void reset(){
+    mCharPos = 0;
+    mCurrentChar = 0;
+    mBuffer.clear();
+  }
+
+  void save(SnapshotWriter& writer) const {
+    writer.value(mCharPos);
+    writer.value(mCurrentChar);
+    mBuffer.save(writer);
+  }
+
+  bool restore(SnapshotReader& reader){
+    reader.value(mCharPos);
+    reader.value(mCurrentChar);
+    return mBuffer.restore(reader);
   }
 
   void update(bool bit){
@@ -75,49 +119,72 @@ public:
   }
 
 private:
+  // The byte a record above, 0 before the first record is complete like the
+  // orders longer than the input
+  unsigned char byteAbove() const {
+    return mBuffer.size() >= mStride ? mBuffer[mBuffer.size() - mStride] : 0;
+  }
+
   unsigned mCharPos;
   unsigned char mCurrentChar;
+  unsigned mStride;
   CircularBuffer<unsigned char> mBuffer;
 };
 
-template<typename Ctx>
+template<unsigned MaxOrder, unsigned HashSize, bool Records>
+constexpr unsigned BasicRNAContext<MaxOrder, HashSize, Records>::HashedContexts;
+template<unsigned MaxOrder, unsigned HashSize, bool Records>
+constexpr unsigned BasicRNAContext<MaxOrder, HashSize, Records>::ContextSize;
+template<unsigned MaxOrder, unsigned HashSize, bool Records>
+constexpr unsigned BasicRNAContext<MaxOrder, HashSize, Records>::Contexts;
+
+using RNAContext = BasicRNAContext<5, 16777214>;
+
+// Weights are stored as Weight and computed as FixedPoint20, and saturate
+// instead of wrapping, in either width. The training rate is a setting of
+// the model, the production model types take theirs from ModelSelection.h.
+template<typename Ctx, typename Weight = FixedPoint20>
 class RNAModel : public Model {
 public:
-  RNAModel() :
-  mContext()
-  {
-    mMatrix.resize(Ctx::ContextSize, 1);
-    mMatrix.init([&](unsigned, unsigned) -> FixedPoint20 {
-      return FixedPoint20(0);
-    });
-  }
+  static constexpr double DefaultRate = 0.375;
+
+  RNAModel(Ctx const& context = Ctx(), FixedPoint20 rate = FixedPoint20(DefaultRate)) :
+  mContext(context),
+  mWeights(Ctx::ContextSize),
+  mRate(rate)
+  { }
 
   FixedPoint20 activation_function(FixedPoint20 const& x){
-    return FixedPoint20::Unit() / (FixedPoint20::Unit() + (-x).exp());
-  }
-  FixedPoint20 activation_derivative(FixedPoint20 const& x){
-    return activation_function(x) * (FixedPoint20::Unit() - activation_function(x));
+    return SquashTable::get().squash(x);
   }
 
   virtual std::uint32_t predict() override {
     mResult = FixedPoint20();
     mContext.iterateOnContext([&](unsigned i){
-      mResult += mMatrix.at(0, i);
+      mResult += weight(i);
     });
-    mDerivative = activation_derivative(mResult);
     mResult = activation_function(mResult);
+    mDerivative = SquashTable::derivative(mResult);
 
     std::uint32_t prediction = mResult.value() << 12;
     return prediction;
   }
 
   void train(bool b) {
-    FixedPoint20 training_rate = FixedPoint20(0.375);
+    FixedPoint20 const training_rate = mRate;
     // --- Create except vector ---
     FixedPoint20 delta = (mResult - (b ? FixedPoint20(1.0) : FixedPoint20(0.0))) * mDerivative;
 
     mContext.iterateOnContext([&](unsigned i){
-      mMatrix.at(0, i) -= training_rate * delta;
+      setWeight(i, weight(i).saturatingSub(training_rate * delta));
+    });
+  }
+
+  // Calls f(order, weight) for the contexts of the current bit
+  void iterateOnWeights(std::function<void(unsigned, FixedPoint20)> const& f){
+    unsigned order = 0;
+    mContext.iterateOnContext([&](unsigned i){
+      f(order++, weight(i));
     });
   }
 
@@ -128,9 +195,91 @@ public:
     mContext.update(b);
   }
 
+  virtual void encode(Encoder& encoder, unsigned char byte) override {
+    codeByte([&](std::uint32_t pred, unsigned i){
+      bool bit = byte & (0x80 >> i);
+      encoder.encode(bit, pred);
+      return bit;
+    });
+  }
+
+  virtual unsigned char decode(Decoder& decoder) override {
+    unsigned char byte = 0;
+    codeByte([&](std::uint32_t pred, unsigned i){
+      bool bit = decoder.decode(pred);
+      byte |= bit << (7 - i);
+      return bit;
+    });
+    return byte;
+  }
+
+  virtual void predictByte(unsigned char byte, std::uint32_t* predictions) override {
+    codeByte([&](std::uint32_t pred, unsigned i){
+      predictions[i] = pred;
+      return static_cast<bool>(byte & (0x80 >> i));
+    });
+  }
+
+  virtual void learn(unsigned char byte) override {
+    codeByte([&](std::uint32_t, unsigned i){
+      return static_cast<bool>(byte & (0x80 >> i));
+    });
+  }
+
+  virtual void reset() override {
+    mContext.reset();
+    mWeights.reset();
+  }
+
+  virtual bool save(SnapshotWriter& writer) const override {
+    writer.section("RNAModel");
+    mContext.save(writer);
+    mWeights.save(writer);
+    return writer.good();
+  }
+
+  virtual bool restore(SnapshotReader& reader) override {
+    return reader.section("RNAModel") && mContext.restore(reader) && mWeights.restore(reader);
+  }
+
 private:
+  FixedPoint20 weight(std::uint32_t i) const {
+    return FixedPoint20::From(mWeights[i]);
+  }
+  void setWeight(std::uint32_t i, FixedPoint20 w){
+    mWeights[i] = Weight::From(w);
+  }
+
+  // Byte at a time predict and update, giving the same predictions : the
+  // contexts are hashed once per byte, and each bit reuses its slots for
+  // training. code(prediction, bit index) returns the coded bit.
+  template<typename Code>
+  void codeByte(Code code){
+    std::array<std::uint32_t, Ctx::Contexts> bases, slots;
+    mContext.byteBases(bases);
+    FixedPoint20 const training_rate = mRate;
+    for(unsigned i = 0; i < 8; ++i){
+      mContext.bitSlots(bases, slots);
+      FixedPoint20 sum;
+      for(std::uint32_t slot : slots){
+        sum += weight(slot);
+      }
+      mResult = activation_function(sum);
+      mDerivative = SquashTable::derivative(mResult);
+      bool bit = code(mResult.value() << 12, i);
+      FixedPoint20 step = training_rate * ((mResult - (bit ? FixedPoint20(1.0) : FixedPoint20(0.0))) * mDerivative);
+      for(std::uint32_t slot : slots){
+        setWeight(slot, weight(slot).saturatingSub(step));
+      }
+      mContext.update(bit);
+    }
+  }
+
   Ctx mContext;
-  Matrix<FixedPoint20> mMatrix;
-  std::default_random_engine random_generator;
+  Table<Weight> mWeights;
+  FixedPoint20 mRate;
   FixedPoint20 mResult, mDerivative;
-};
\ No newline at end of file
+};
+
+template<typename Ctx, typename Weight>
+constexpr double RNAModel<Ctx, Weight>::DefaultRate;
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// --- Snapshot format ---
+// "TIPS", then the sections written by the models. A section starts with its
+// name, values are stored raw. Arrays are aligned on pages so that a reader can
+// map them in place instead of copying them.
+
+class SnapshotWriter {
+public:
+  static constexpr std::uint64_t Alignment = 4096;
+
+  SnapshotWriter(std::ostream& stream) : mStream(stream), mOffset(0){
+    raw("TIPS", 4);
+  }
+
+  bool good() const { return mStream.good(); }
+
+  void section(std::string const& name){
+    value(static_cast<std::uint32_t>(name.size()));
+    raw(name.data(), name.size());
+  }
+
+  template<typename T>
+  void value(T const& v){
+    static_assert(std::is_trivially_copyable<T>::value, "");
+    raw(&v, sizeof(T));
+  }
+
+  template<typename T>
+  void array(T const* data, std::uint64_t count){
+    static_assert(std::is_trivially_copyable<T>::value, "");
+    value(count);
+    static char const zeros[Alignment] = {};
+    raw(zeros, (Alignment - mOffset % Alignment) % Alignment);
+    raw(data, count * sizeof(T));
+  }
+
+private:
+  void raw(void const* data, std::uint64_t size){
+    mStream.write(static_cast<char const*>(data), size);
+    mOffset += size;
+  }
+
+  std::ostream& mStream;
+  std::uint64_t mOffset;
+};
+
+class SnapshotReader {
+public:
+  // The file is mapped privately : it is never modified, pages are copied when
+  // a restored model writes to them.
+  SnapshotReader(std::string const& filename) : mSize(0), mOffset(0), mGood(false){
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0) return;
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size >= 4){
+      std::uint64_t size = st.st_size;
+      void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      if(data != MAP_FAILED){
+        mMapping = std::shared_ptr<char>(static_cast<char*>(data), [size](char* p){ munmap(p, size); });
+        mSize = size;
+        mGood = std::memcmp(mMapping.get(), "TIPS", 4) == 0;
+        mOffset = 4;
+      }
+    }
+    close(fd);
+  }
+
+  bool good() const { return mGood; }
+
+  bool section(std::string const& name){
+    std::uint32_t size = 0;
+    value(size);
+    if(!mGood || size != name.size() || mOffset + size > mSize
+      || std::memcmp(mMapping.get() + mOffset, name.data(), size) != 0){
+      mGood = false;
+      return false;
+    }
+    mOffset += size;
+    return true;
+  }
+
+  template<typename T>
+  void value(T& v){
+    static_assert(std::is_trivially_copyable<T>::value, "");
+    if(!mGood || mOffset + sizeof(T) > mSize){
+      mGood = false;
+      return;
+    }
+    std::memcpy(&v, mMapping.get() + mOffset, sizeof(T));
+    mOffset += sizeof(T);
+  }
+
+  // Returns a view of the next array, which stays valid as long as owner lives
+  template<typename T>
+  T* array(std::uint64_t& count, std::shared_ptr<void>& owner){
+    static_assert(std::is_trivially_copyable<T>::value, "");
+    count = 0;
+    value(count);
+    mOffset += (SnapshotWriter::Alignment - mOffset % SnapshotWriter::Alignment) % SnapshotWriter::Alignment;
+    if(!mGood || mOffset > mSize || count > (mSize - mOffset) / sizeof(T)){
+      mGood = false;
+      return nullptr;
+    }
+    T* data = reinterpret_cast<T*>(mMapping.get() + mOffset);
+    mOffset += count * sizeof(T);
+    owner = mMapping;
+    return data;
+  }
+
+  // Copies the next array, which must have exactly count elements
+  template<typename T>
+  bool copyArray(T* data, std::uint64_t count){
+    std::uint64_t stored;
+    std::shared_ptr<void> owner;
+    T const* view = array<T>(stored, owner);
+    if(!view || stored != count){
+      mGood = false;
+      return false;
+    }
+    std::memcpy(data, view, count * sizeof(T));
+    return true;
+  }
+
+private:
+  std::shared_ptr<char> mMapping;
+  std::uint64_t mSize, mOffset;
+  bool mGood;
+};
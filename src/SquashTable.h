@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cinttypes>
+#include <array>
+
+#include "FixedPoint.h"
+
+// --- SquashTable ---
+// The logistic function 1 / (1 + e^-x) shared by the models. Entries every
+// 1/128 from -Range to Range are computed once with the fixed point exp and
+// division, and interpolated linearly in between : no exp nor division per
+// bit, and the same integers on every machine, so that the encoder and the
+// decoder always agree. Results stay strictly between 0 and 1, the coder
+// needs both bits to remain possible.
+
+class SquashTable {
+public:
+  static constexpr std::int32_t Range = 16;
+  static constexpr unsigned StepBits = 13;
+  static constexpr unsigned Size = (2 * Range << (20 - StepBits)) + 1;
+
+  static SquashTable const& get(){
+    static SquashTable const table;
+    return table;
+  }
+
+  FixedPoint20 squash(FixedPoint20 x) const {
+    std::int32_t v = x.value();
+    if(v <= -(Range << 20)) return mTable[0];
+    if(v >= (Range << 20)) return mTable[Size - 1];
+    std::uint32_t u = v + (Range << 20);
+    unsigned i = u >> StepBits;
+    std::int32_t fraction = u & ((1 << StepBits) - 1);
+    std::int32_t low = mTable[i].value(), high = mTable[i + 1].value();
+    return FixedPoint20::FromValue(low + (((high - low) * fraction) >> StepBits));
+  }
+
+  // Derivative of the logistic function from its result
+  static FixedPoint20 derivative(FixedPoint20 squashed){
+    return squashed * (FixedPoint20::Unit() - squashed);
+  }
+
+private:
+  SquashTable(){
+    // Only the x >= 0 half, the other one is 1 - squash(-x)
+    for(unsigned i = Size / 2; i < Size; ++i){
+      FixedPoint20 x = FixedPoint20::FromValue((static_cast<std::int32_t>(i) << StepBits) - (Range << 20));
+      std::int32_t s = (FixedPoint20::Unit() / (FixedPoint20::Unit() + expMinus(x))).value();
+      s = std::min<std::int32_t>(s, FixedPoint20::Unit().value() - 1);
+      mTable[i] = FixedPoint20::FromValue(s);
+      mTable[Size - 1 - i] = FixedPoint20::FromValue(FixedPoint20::Unit().value() - s);
+    }
+  }
+
+  // e^-x for x >= 0. The fixed point exp of -x goes through e^x, which
+  // overflows FixedPoint20 near 7.6 : larger x are halved, and the result
+  // squared, until x is below 4. x is a multiple of 2^-7, halving it is
+  // exact.
+  static FixedPoint20 expMinus(FixedPoint20 x){
+    if(x.value() < (4 << 20)) return (-x).exp();
+    FixedPoint20 half = expMinus(FixedPoint20::FromValue(x.value() / 2));
+    return half * half;
+  }
+
+  std::array<FixedPoint20, Size> mTable;
+};
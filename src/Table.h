@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+#include <sys/mman.h>
+
+#include "PageAllocator.h"
+#include "Snapshot.h"
+
+// --- Table ---
+// Large flat table of model weights. The storage is either zeroed memory from
+// the PageAllocator or a copy on write view of a snapshot.
+
+template<typename T>
+class Table {
+  static_assert(std::is_trivially_copyable<T>::value, "");
+public:
+  Table() : mData(nullptr), mSize(0), mPage(0), mMapped(false){ }
+  Table(std::size_t size) : Table(){ resize(size); }
+
+  Table(Table const& other) = delete;
+  Table& operator=(Table const& other) = delete;
+
+  // Allocates a new zeroed table, the system hands out zero pages lazily
+  void resize(std::size_t size){
+    mOwner = PageAllocator::allocate(size * sizeof(T), mPage);
+    mData = static_cast<T*>(mOwner.get());
+    mSize = size;
+    mMapped = false;
+  }
+
+  // Zeroes the table in place, a mapped snapshot is replaced by fresh memory
+  // rather than copied page by page. The whole pages of a large table are
+  // given back instead of written, the system hands out zero pages again on
+  // first touch : a reset costs the pages used since, not the table size.
+  void reset(){
+    if(mMapped){
+      resize(mSize);
+      return;
+    }
+    char* begin = reinterpret_cast<char*>(mData);
+    char* end = begin + mSize * sizeof(T);
+    std::uintptr_t page = mPage;
+    char* first = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(begin) + page - 1) & ~(page - 1));
+    char* last = reinterpret_cast<char*>(reinterpret_cast<std::uintptr_t>(end) & ~(page - 1));
+    if(end - begin >= (1 << 20) && first < last && madvise(first, last - first, MADV_DONTNEED) == 0){
+      std::memset(begin, 0, first - begin);
+      std::memset(last, 0, end - last);
+    }else{
+      std::memset(begin, 0, end - begin);
+    }
+  }
+
+  std::size_t size() const { return mSize; }
+  T* data() { return mData; }
+  T const* data() const { return mData; }
+
+  T& operator[](std::size_t i){ assert(i < mSize); return mData[i]; }
+  T const& operator[](std::size_t i) const { assert(i < mSize); return mData[i]; }
+
+  void save(SnapshotWriter& writer) const {
+    writer.array(mData, mSize);
+  }
+
+  // Maps the snapshot table instead of copying it
+  bool restore(SnapshotReader& reader){
+    std::uint64_t size;
+    std::shared_ptr<void> owner;
+    T* data = reader.array<T>(size, owner);
+    if(!data || size != mSize) return false;
+    mOwner = std::move(owner);
+    mData = data;
+    mMapped = true;
+    return true;
+  }
+
+private:
+  std::shared_ptr<void> mOwner;
+  T* mData;
+  std::size_t mSize;
+  std::size_t mPage; // Reset granularity
+  bool mMapped;
+};
@@ -0,0 +1,133 @@
+#pragma once
+#include "Model.h"
+
+#include <istream>
+#include <ostream>
+#include <vector>
+
+// --- Trace format ---
+// A trace records what a set of models predicted for every coded bit, so that
+// coders and mixers can be benchmarked without re-running the models.
+//   header : "TIPT", uint8 version 2, uint8 model count
+//   frame  : 8 coded bits packed in a byte, first bit in the high bit, then
+//            for each bit one little-endian uint16 prediction per model
+// The last frame may hold fewer bits, the reader tells how many from its
+// size. Predictions keep their 16 high bits, and replay at the middle of the
+// interval they stand for : the cost table only resolves 12 bits, and the
+// coder loses a few bytes per megabyte. About 2 N bytes per coded bit for N
+// models.
+
+class TraceWriter {
+public:
+  static constexpr unsigned FrameBits = 8;
+
+  TraceWriter(std::ostream& stream, unsigned modelCount) :
+  mStream(stream), mModelCount(modelCount), mBits(0), mFrame(frameSize(modelCount, FrameBits)){
+    assert(modelCount <= 255);
+    mStream.write("TIPT", 4);
+    mStream.put(2);
+    mStream.put(static_cast<char>(modelCount));
+  }
+
+  ~TraceWriter(){
+    flush();
+  }
+
+  void write(std::uint32_t const* predictions, bool bit){
+    if(mBits == 0) mFrame[0] = 0;
+    mFrame[0] |= bit << (FrameBits - 1 - mBits);
+    unsigned char* out = &mFrame[1 + 2 * mModelCount * mBits];
+    for(unsigned i = 0; i < mModelCount; ++i){
+      out[2 * i] = predictions[i] >> 16;
+      out[2 * i + 1] = predictions[i] >> 24;
+    }
+    if(++mBits == FrameBits) flush();
+  }
+
+  // Writes the bits of a partial frame, the trace ends there
+  void flush(){
+    mStream.write(reinterpret_cast<char const*>(mFrame.data()), frameSize(mModelCount, mBits));
+    mBits = 0;
+  }
+
+  // Bytes of a frame of bits bits, none for an empty one
+  static std::size_t frameSize(unsigned modelCount, unsigned bits){
+    return bits == 0 ? 0 : 1 + 2 * modelCount * bits;
+  }
+
+private:
+  std::ostream& mStream;
+  unsigned mModelCount;
+  unsigned mBits;
+  std::vector<unsigned char> mFrame;
+};
+
+class TraceReader {
+public:
+  TraceReader(std::istream& stream) :
+  mStream(stream), mModelCount(0), mBits(0), mNext(0), mBit(false){
+    char magic[5];
+    mStream.read(magic, 5);
+    if(mStream.good() && magic[0] == 'T' && magic[1] == 'I' && magic[2] == 'P' && magic[3] == 'T' && magic[4] == 2){
+      mModelCount = static_cast<unsigned char>(mStream.get());
+    }
+    mFrame.resize(TraceWriter::frameSize(mModelCount, TraceWriter::FrameBits));
+    mPredictions.resize(mModelCount);
+  }
+
+  bool valid() const { return mModelCount != 0; }
+  unsigned modelCount() const { return mModelCount; }
+
+  // Moves to the next bit, returns false at the end of the trace
+  bool next(){
+    if(!valid()) return false;
+    if(mNext == mBits){
+      mStream.read(reinterpret_cast<char*>(mFrame.data()), mFrame.size());
+      std::size_t size = mStream.gcount();
+      if(size < TraceWriter::frameSize(mModelCount, 1)) return false;
+      mBits = (size - 1) / (2 * mModelCount);
+      mNext = 0;
+    }
+    mBit = (mFrame[0] >> (TraceWriter::FrameBits - 1 - mNext)) & 1;
+    unsigned char const* in = &mFrame[1 + 2 * mModelCount * mNext];
+    for(unsigned i = 0; i < mModelCount; ++i){
+      mPredictions[i] = (static_cast<std::uint32_t>(in[2 * i]) << 16) | (static_cast<std::uint32_t>(in[2 * i + 1]) << 24) | 0x8000;
+    }
+    mNext++;
+    return true;
+  }
+
+  bool bit() const { return mBit; }
+  std::uint32_t prediction(unsigned i) const { return mPredictions[i]; }
+
+private:
+  std::istream& mStream;
+  unsigned mModelCount;
+  unsigned mBits, mNext; // In the current frame
+  bool mBit;
+  std::vector<unsigned char> mFrame;
+  std::vector<std::uint32_t> mPredictions;
+};
+
+// --- TraceModel ---
+// Replays the predictions of one recorded model from the current frame.
+// The driver advances the reader, so update does nothing.
+
+class TraceModel : public Model {
+public:
+  TraceModel(TraceReader const& reader, unsigned id) :
+  mReader(reader), mId(id){ }
+  virtual ~TraceModel(){ }
+
+  virtual std::uint32_t predict() override {
+    return mReader.prediction(mId);
+  }
+
+  virtual void update(bool) override { }
+
+  virtual void reset() override { }
+
+private:
+  TraceReader const& mReader;
+  unsigned mId;
+};
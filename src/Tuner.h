@@ -0,0 +1,270 @@
+#pragma once
+
+#include "BitPPMModel.h"
+#include "BitRNAModel.h"
+#include "BytePPMModel.h"
+#include "CostTable.h"
+#include "JobScheduler.h"
+#include "MixModel.h"
+#include "ModelSelection.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// --- Hyperparameters ---
+// The settings of the models that the tuner searches. Each model reads the
+// ones it has, the fractions of integer counts are kept in twentieths.
+
+enum class Setting : unsigned {
+  Rate,       // RNAModel training rate
+  BitRNARate, // BitRNAModel training rate
+  MixRate,    // MixModel learning rate
+  PPMDecay,   // BitPPMModel weight of an order against the next shorter one
+  PPMGrowth   // BytePPMModel growth of the counts with the order
+};
+
+struct Hyperparameters {
+  static constexpr unsigned Count = 5;
+  static constexpr std::uint32_t RatioDenominator = 20;
+
+  // The settings the models are built with
+  static Hyperparameters defaults(){
+    Hyperparameters h;
+    h[Setting::Rate] = RNAModel<SmallRNAContext>::DefaultRate;
+    h[Setting::BitRNARate] = BitRNAModel<16>::DefaultRate;
+    h[Setting::MixRate] = MixModel::DefaultRate;
+    h[Setting::PPMDecay] = 0.8;
+    h[Setting::PPMGrowth] = 1.5;
+    return h;
+  }
+
+  double& operator[](Setting s){ return values[static_cast<unsigned>(s)]; }
+  double operator[](Setting s) const { return values[static_cast<unsigned>(s)]; }
+
+  Ratio ratio(Setting s) const {
+    return Ratio{ static_cast<std::uint32_t>(std::lround((*this)[s] * RatioDenominator)), RatioDenominator };
+  }
+
+  static char const* name(Setting s){
+    static char const* const names [] = { "rate", "bitrna", "mix", "decay", "growth" };
+    return names[static_cast<unsigned>(s)];
+  }
+
+  std::array<double, Count> values;
+};
+
+// --- TuneTarget ---
+// A model the tuner can build with any settings, and the settings it reads
+
+struct TuneTarget {
+  std::string name;
+  std::vector<Setting> settings;
+  std::uint64_t memory; // Bytes a model takes, for the job scheduler
+  Hyperparameters start;
+  std::string promote;  // Where the settings are fixed at compile time
+  std::function<std::unique_ptr<Model>(Hyperparameters const&)> make;
+};
+
+// Small RNAModel mixed with a BitPPMModel, owning them
+struct TunedMixInputs {
+  TunedMixInputs(Hyperparameters const& h) :
+  rna(SmallRNAContext(), FixedPoint20(h[Setting::Rate])), ppm(BitPPMModel<16>::DefaultWindow, 22, h.ratio(Setting::PPMDecay)){ }
+  RNAModel<SmallRNAContext> rna;
+  BitPPMModel<16> ppm;
+};
+
+class TunedMix : private TunedMixInputs, public MixModel {
+public:
+  TunedMix(Hyperparameters const& h) :
+  TunedMixInputs(h), MixModel({ &rna, &ppm }, {}, FixedPoint24(h[Setting::MixRate])){ }
+};
+
+// A model type name of ModelSelection.h, or bitrna, bitppm, byteppm or mix
+inline bool parseTuneTarget(std::string const& name, std::uint32_t parameter, TuneTarget& target){
+  target.name = name;
+  target.start = Hyperparameters::defaults();
+  std::uint64_t const ppmMemory = std::uint64_t(2 << 22) * sizeof(std::uint32_t);
+  ModelType type;
+  if(parseModelType(name, type)){
+    if(type == ModelType::Flat) return false;
+    target.settings = { Setting::Rate };
+    target.memory = modelMemory(type);
+    target.start[Setting::Rate] = tunedRate(type);
+    target.promote = "the " + name + " entry of TunedRates in ModelSelection.h";
+    target.make = [=](Hyperparameters const& h){ return makeModel(type, parameter, h[Setting::Rate]); };
+  }else if(name == "bitrna"){
+    target.settings = { Setting::BitRNARate };
+    target.memory = std::uint64_t(1) << 20;
+    target.promote = "BitRNAModel::DefaultRate";
+    target.make = [](Hyperparameters const& h){
+      return std::unique_ptr<Model>(new BitRNAModel<16>(FixedPoint20(h[Setting::BitRNARate])));
+    };
+  }else if(name == "bitppm"){
+    target.settings = { Setting::PPMDecay };
+    target.memory = ppmMemory;
+    target.promote = "the decay default of BitPPMModel";
+    target.make = [](Hyperparameters const& h){
+      return std::unique_ptr<Model>(new BitPPMModel<16>(BitPPMModel<16>::DefaultWindow, 22, h.ratio(Setting::PPMDecay)));
+    };
+  }else if(name == "byteppm"){
+    // The tree grows with the input, this is a guess
+    target.settings = { Setting::PPMGrowth };
+    target.memory = std::uint64_t(64) << 20;
+    target.promote = "the growth default of BytePPMModel";
+    target.make = [](Hyperparameters const& h){
+      return std::unique_ptr<Model>(new BytePPMModel<3>(4, h.ratio(Setting::PPMGrowth)));
+    };
+  }else if(name == "mix"){
+    target.settings = { Setting::Rate, Setting::PPMDecay, Setting::MixRate };
+    target.memory = modelMemory(ModelType::Small) + ppmMemory;
+    target.promote = "the defaults of RNAModel, BitPPMModel and MixModel";
+    target.make = [](Hyperparameters const& h){ return std::unique_ptr<Model>(new TunedMix(h)); };
+  }else{
+    return false;
+  }
+  return true;
+}
+
+// --- Tuner ---
+// Searches the settings of a target on a corpus, one setting at a time : each
+// round tries every setting of the target scaled by a few factors around the
+// best compression found so far, with narrower factors each round. The
+// candidates run as jobs in parallel, each one codes every file of the corpus
+// from a fresh model and counts the bytes the coder would write. The report
+// marks the Pareto front of size against speed.
+
+class Tuner {
+public:
+  struct Result {
+    Hyperparameters settings;
+    std::uint64_t bytes;
+    double seconds;
+    bool front;
+  };
+
+  Tuner(TuneTarget target, std::vector<std::vector<char>> corpus) :
+  mTarget(std::move(target)), mCorpus(std::move(corpus)){ }
+
+  void run(unsigned rounds, unsigned workers, std::uint64_t budget){
+    std::uint64_t total = 0;
+    for(std::vector<char> const& file : mCorpus) total += file.size();
+    std::cout << "Tuning " << mTarget.name << " on " << mCorpus.size() << " files, " << total << " bytes, "
+      << workers << " jobs at once" << std::endl;
+    Hyperparameters center = mTarget.start;
+    for(unsigned round = 0; round < rounds; ++round){
+      std::vector<Hyperparameters> tried = candidates(center, std::pow(0.5, round));
+      std::size_t first = mResults.size();
+      mResults.resize(first + tried.size());
+      JobScheduler scheduler(workers, budget);
+      for(std::size_t i = 0; i < tried.size(); ++i){
+        Result* result = &mResults[first + i];
+        result->settings = tried[i];
+        scheduler.add({ describe(tried[i]), total, mTarget.memory + (std::uint64_t(16) << 20), [this, result](){
+          evaluate(*result);
+          return true;
+        }});
+      }
+      scheduler.run();
+      center = best().settings;
+    }
+    report(total);
+  }
+
+  Result const& best() const {
+    return *std::min_element(mResults.begin(), mResults.end(), [](Result const& a, Result const& b){
+      return a.bytes < b.bytes || (a.bytes == b.bytes && a.seconds < b.seconds);
+    });
+  }
+
+  std::vector<Result> const& results() const { return mResults; }
+
+private:
+  // The center and each setting of the target scaled by the factors, raised
+  // to narrow, without the ones already tried
+  std::vector<Hyperparameters> candidates(Hyperparameters const& center, double narrow) const {
+    static double const factors [] = { 0.5, 0.7, 1.4, 2.0 };
+    std::vector<Hyperparameters> result;
+    auto add = [&](Hyperparameters const& h){
+      auto same = [&](Hyperparameters const& other){ return describe(other) == describe(h); };
+      if(std::none_of(result.begin(), result.end(), same)
+        && std::none_of(mResults.begin(), mResults.end(), [&](Result const& r){ return same(r.settings); })){
+        result.push_back(h);
+      }
+    };
+    add(center);
+    for(Setting s : mTarget.settings){
+      for(double factor : factors){
+        Hyperparameters h = center;
+        h[s] = center[s] * std::pow(factor, narrow);
+        // Fractions of counts only have twentieths
+        if(s == Setting::PPMDecay || s == Setting::PPMGrowth) h[s] = h.ratio(s).value();
+        add(h);
+      }
+    }
+    return result;
+  }
+
+  void evaluate(Result& result) const {
+    CostTable const& costs = CostTable::get();
+    std::unique_ptr<Model> model = mTarget.make(result.settings);
+    std::uint64_t cost = 0;
+    std::uint32_t predictions[8];
+    auto start = std::chrono::steady_clock::now();
+    for(std::vector<char> const& file : mCorpus){
+      model->reset();
+      for(char ch : file){
+        unsigned char byte = ch;
+        model->predictByte(byte, predictions);
+        for(unsigned i = 0; i < 8; ++i){
+          cost += costs.cost(predictions[i], byte & (0x80 >> i)).value();
+        }
+      }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    result.bytes = cost >> 23;
+    result.seconds = elapsed.count();
+  }
+
+  std::string describe(Hyperparameters const& h) const {
+    std::ostringstream out;
+    for(Setting s : mTarget.settings){
+      if(s != mTarget.settings.front()) out << " ";
+      out << Hyperparameters::name(s) << "=" << h[s];
+    }
+    return out.str();
+  }
+
+  // A result is on the front when no other one is as small and as fast, and
+  // smaller or faster
+  void report(std::uint64_t total){
+    for(Result& r : mResults){
+      r.front = std::none_of(mResults.begin(), mResults.end(), [&](Result const& o){
+        return o.bytes <= r.bytes && o.seconds <= r.seconds && (o.bytes < r.bytes || o.seconds < r.seconds);
+      });
+    }
+    std::vector<Result> sorted = mResults;
+    std::sort(sorted.begin(), sorted.end(), [](Result const& a, Result const& b){ return a.bytes < b.bytes; });
+    std::cout << "Results, * on the Pareto front of size against speed :" << std::endl;
+    for(Result const& r : sorted){
+      std::cout << (r.front ? "  * " : "    ") << describe(r.settings) << " : " << r.bytes << " bytes, "
+        << (r.seconds > 0 ? total / r.seconds / 1e6 : 0.0) << " MB/s" << std::endl;
+    }
+    Result const& b = best();
+    std::cout << "Smallest : " << describe(b.settings) << ", " << b.bytes << " bytes against "
+      << mResults.front().bytes << " with the current settings" << std::endl;
+    std::cout << "Promote a setting of the front with " << mTarget.promote
+      << ", then update the archive version and the golden digests" << std::endl;
+  }
+
+  TuneTarget mTarget;
+  std::vector<std::vector<char>> mCorpus;
+  std::vector<Result> mResults;
+};
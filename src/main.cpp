@@ -7,144 +7,975 @@
 #include "RNAModel.h"
 #include "BytePPMModel.h"
 #include "BitPPMModel.h"
+#include "BitPPMTreeModel.h"
 #include "MixModel.h"
+#include "Trace.h"
+#include "CostTable.h"
+#include "Archive.h"
+#include "Archiver.h"
+#include "Checksum.h"
+#include "Filter.h"
+#include "Golden.h"
+#include "Pipeline.h"
+#include "Daemon.h"
+#include "JobScheduler.h"
+#include "Tuner.h"
 
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <string>
+#include <sstream>
+#include <chrono>
 #include <cinttypes>
+#include <array>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <thread>
 
-void archive(std::string const& filename){
-  std::cout << "Archiving " << filename << std::endl;
-  std::ifstream file(filename);
-  if(!file.good()){
-    std::cout << "Can't open file " << filename << std::endl;
-    return;
+// --- Options ---
+
+struct Options {
+  std::string snapshot; // Initial model state, or primed model output
+  std::string output;   // Archive name, defaults to the first file name + ".out"
+  std::uint64_t blockSize = 0; // Independently decodable blocks, 0 for a single block
+  std::string model;    // Model type, chosen from a sample of the input when empty
+  std::uint32_t modelParameter = 0;
+  std::string filter;   // Filter name, detected from a sample of the input when empty
+  unsigned words = Dictionary::ShortCodes + Dictionary::LongCodes; // Dictionary size limit, 0 for none
+  unsigned threads = 4; // Daemon, jobs and tuner workers
+  std::uint64_t memory = std::uint64_t(1) << 30; // Daemon, jobs and tuner model memory budget
+  bool quiet = false;   // No per entry progress
+  bool parallel = false; // Mixed models on their own threads
+};
+
+// Sort key grouping similar files together : text before binary, then extension
+std::pair<bool, std::string> file_kind(std::string const& filename){
+  std::ifstream file(filename, std::ios::binary);
+  char sample[4096];
+  file.read(sample, sizeof(sample));
+  unsigned binary = 0;
+  for(std::streamsize i = 0; i < file.gcount(); ++i){
+    unsigned char ch = sample[i];
+    if(ch == 0 || (ch < 32 && ch != '\n' && ch != '\r' && ch != '\t')) binary++;
   }
-  
-  // --- Get file size ---
-  file.seekg(0, std::ios::end);
-  std::uint32_t file_length = file.tellg();
-  file.seekg(0, std::ios::beg);
+  std::size_t slash = filename.find_last_of('/');
+  std::size_t dot = filename.find_last_of('.');
+  std::string extension = (dot == std::string::npos || (slash != std::string::npos && dot < slash)) ? "" : filename.substr(dot + 1);
+  return { 10 * binary > static_cast<unsigned>(file.gcount()), extension };
+}
 
-  std::cout << "Size : " << file_length << std::endl;
+// First pass : evenly spaced windows of the entries, to pick the filter and the model
+std::vector<std::vector<unsigned char>> sample_input(ArchiveHeader const& header){
+  static constexpr unsigned Windows = 16;
+  static constexpr unsigned WindowSize = 8192;
+  std::uint64_t total = header.totalSize();
+  // Windows must not overlap on small inputs, or every string looks repeated
+  std::uint64_t windowSize = std::min<std::uint64_t>(WindowSize, (total + Windows - 1) / Windows);
+  std::vector<std::vector<unsigned char>> windows;
+  std::uint64_t entryStart = 0;
+  unsigned w = 0;
+  for(ArchiveEntry const& entry : header.entries){
+    std::ifstream file(entry.name, std::ios::binary);
+    for(; w < Windows && total * w / Windows < entryStart + entry.size; ++w){
+      std::vector<unsigned char> window(windowSize);
+      file.clear();
+      file.seekg(total * w / Windows - entryStart);
+      file.read((char*) window.data(), window.size());
+      window.resize(file.gcount());
+      windows.push_back(window);
+    }
+    entryStart += entry.size;
+  }
+  return windows;
+}
 
-  // --- Open out file ---
+// First pass over the whole input : the words worth replacing, none unless the
+// dictionary saves a tenth of the input
+Dictionary build_dictionary(ArchiveHeader const& header, unsigned maxWords){
+  Dictionary::Counts counts;
+  std::vector<unsigned char> buffer(ArchiveHeader::ChunkSize);
+  for(ArchiveEntry const& entry : header.entries){
+    std::ifstream file(entry.name, std::ios::binary);
+    while(file.read((char*) buffer.data(), buffer.size()) || file.gcount() > 0){
+      Dictionary::count(buffer.data(), file.gcount(), counts);
+    }
+  }
+  Dictionary dictionary;
+  dictionary.build(counts, maxWords);
+  std::int64_t savings = dictionary.savings(counts);
+  std::cout << "Dictionary : " << dictionary.size() << " words, " << dictionary.storedSize()
+    << " bytes, saves " << savings << " bytes" << std::endl;
+  if(10 * savings < static_cast<std::int64_t>(header.totalSize())) return Dictionary();
+  return dictionary;
+}
+
+// The windows are filtered the way the model will see them
+ModelType choose_model(std::vector<std::vector<unsigned char>> windows, Filter filter, std::uint64_t total, std::uint32_t& parameter){
+  InputSampler sampler;
+  for(std::vector<unsigned char>& window : windows){
+    filter.encode(window.data(), window.size(), 0);
+    sampler.sample(window.data(), window.size());
+  }
+  ModelType type = sampler.choose(total, parameter);
+  std::cout << "Sample entropy : " << sampler.entropy() << " bpc, repeats : " << sampler.repeatRate()
+    << ", stride : " << sampler.stride() << std::endl;
+  return type;
+}
+
+// Everything about the archive but its content : the file table, the
+// dictionary, the filter and the model. False when the options make no sense.
+bool plan_archive(std::vector<std::string> const& filenames, Options const& options, ArchiveHeader& header){
+  // --- Build the file table ---
+  header = ArchiveHeader();
+  std::vector<std::pair<bool, std::string>> kinds;
+  for(std::string const& filename : filenames){
+    std::ifstream file(filename, std::ios::binary);
+    if(!file.good()){
+      std::cout << "Can't open file " << filename << std::endl;
+      continue;
+    }
+    file.seekg(0, std::ios::end);
+    header.entries.push_back({ filename, static_cast<std::uint64_t>(file.tellg()) });
+    kinds.push_back(file_kind(filename));
+  }
+  std::vector<unsigned> order(header.entries.size());
+  for(unsigned i = 0; i < order.size(); ++i) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b){
+    return kinds[a] < kinds[b];
+  });
+  std::vector<ArchiveEntry> entries;
+  for(unsigned i : order) entries.push_back(header.entries[i]);
+  header.entries = entries;
 
-  std::ofstream out_file(filename + ".out");
-  out_file.write((char const*) &file_length, sizeof(std::uint32_t));
-  Encoder encoder(out_file);
+  header.blockSize = options.blockSize;
+  std::cout << "Files : " << header.entries.size() << ", size : " << header.totalSize() << std::endl;
+
+  // --- Word dictionary, for text ---
+  // A primed snapshot learnt plain text, keep it that way
+  if(options.snapshot.empty() && options.words > 0){
+    header.dictionary = build_dictionary(header, options.words);
+  }
+
+  // --- One filter for the whole archive ---
+  // A primed snapshot learnt unfiltered data, and text needs no filter, keep
+  // them that way unless asked
+  std::vector<std::vector<unsigned char>> windows;
+  if(options.snapshot.empty() && (options.model.empty() || options.filter.empty())){
+    windows = sample_input(header);
+    std::vector<unsigned char> words;
+    for(std::vector<unsigned char>& window : windows){
+      if(header.dictionary.empty()) break;
+      header.dictionary.encode(window.data(), window.size(), words);
+      window = words;
+    }
+  }
+  Filter filter;
+  if(!options.filter.empty()){
+    if(!parseFilter(options.filter, filter)){
+      std::cout << "Unknown filter " << options.filter << std::endl;
+      return false;
+    }
+  }else if(options.snapshot.empty() && header.dictionary.empty()){
+    filter = Filter::detect(windows);
+  }
+  header.filterType = static_cast<std::uint8_t>(filter.type());
+  header.filterParameter = filter.parameter();
+  std::cout << "Filter : " << filter.name() << std::endl;
+
+  // --- One model for the whole archive ---
+  ModelType type = ModelType::Large;
+  if(!options.model.empty()){
+    if(!parseModelType(options.model, type)){
+      std::cout << "Unknown model " << options.model << std::endl;
+      return false;
+    }
+    header.modelParameter = options.modelParameter;
+  }else if(options.snapshot.empty()){
+    type = choose_model(windows, filter, header.totalSize(), header.modelParameter);
+  }
+  header.modelType = static_cast<std::uint8_t>(type);
+  std::cout << "Model : " << modelName(type) << " " << header.modelParameter << std::endl;
+  return true;
+}
+
+// Second pass : codes the entries of the planned header, false when the
+// snapshot can't be restored
+bool write_archive(ArchiveHeader const& header, std::string const& archive_name, Options const& options){
+  // --- Open out file ---
+  std::ofstream out_file(archive_name, std::ios::binary);
+  ArchiveWriter writer(out_file, header, options.snapshot);
+  if(!writer.good()){
+    std::cout << "Can't restore snapshot " << options.snapshot << std::endl;
+    return false;
+  }
 
   // --- Algo ---
-  char ch;
+  // A reader thread fills the buffers ahead of the model, an empty buffer
+  // ends the input
+  SPSCRing<std::vector<char>> buffers(8);
+  std::thread input([&](){
+    for(ArchiveEntry const& entry : header.entries){
+      if(!options.quiet) std::cout << "Archiving " << entry.name << std::endl;
+      std::ifstream file(entry.name, std::ios::binary);
+      std::uint64_t remaining = entry.size;
+      while(remaining > 0){
+        std::vector<char> buffer(std::min<std::uint64_t>(remaining, 1 << 20));
+        file.read(buffer.data(), buffer.size());
+        std::streamsize count = file.gcount();
+        if(count < static_cast<std::streamsize>(buffer.size())){
+          // The file shrank since the table was built, pad with zeros
+          std::fill(buffer.begin() + std::max<std::streamsize>(count, 0), buffer.end(), 0);
+          file.clear();
+          file.seekg(0, std::ios::end);
+        }
+        remaining -= buffer.size();
+        buffers.push(std::move(buffer));
+      }
+    }
+    buffers.push(std::vector<char>());
+  });
+  for(std::vector<char> buffer = buffers.pop(); !buffer.empty(); buffer = buffers.pop()){
+    writer.write(buffer.data(), buffer.size());
+  }
+  input.join();
+  return true;
+}
 
-  RNAModel<RNAContext> model;
-  unsigned done = 0;
-  while(file.good()){
-    if(done % 10000 == 0) std::cout << done << std::endl;
-    file.get(ch);
+void archive(std::vector<std::string> const& filenames, Options const& options){
+  if(filenames.empty()) return;
+  std::string archive_name = options.output.empty() ? filenames[0] + ".out" : options.output;
+  std::cout << "Archiving to " << archive_name << std::endl;
+  ArchiveHeader header;
+  if(plan_archive(filenames, options, header)){
+    write_archive(header, archive_name, options);
+  }
+}
 
-    for(unsigned i = 0; i < 8; ++i){
-      bool bit = ch & (1 << (7-i));
-      std::uint32_t pred = model.predict();
-      // std::cout << "prediction : " << pred << " " << std::setprecision(10) << (double) pred / (double) (1ull << 32) << " " << bit << std::endl;
-      encoder.encode(bit, pred);
-      model.update(bit);
+bool extract(std::string const& filename, Options const& options){
+  if(!options.quiet) std::cout << "Extracting " << filename << std::endl;
+  std::ifstream file(filename, std::ios::binary);
+  if(!file.good()){
+    std::cout << "Can't open file " << filename << std::endl;
+    return false;
+  }
+
+  ArchiveReader reader(file, options.snapshot);
+  if(!reader.good()){
+    std::cout << "Not an archive " << filename << std::endl;
+    return false;
+  }
+
+  // --- Algo ---
+  // A writer thread empties the buffers behind the model, one buffer per
+  // entry at least so that it knows when to open the next file, and checks
+  // each entry against its checksum as it writes it
+  SPSCRing<std::vector<char>> buffers(8);
+  bool intact = true;
+  std::thread output([&](){
+    std::vector<ArchiveEntry> const& entries = reader.header().entries;
+    for(std::size_t i = 0; i < entries.size(); ++i){
+      std::ofstream out_file(entries[i].name + ".orig", std::ios::binary);
+      Crc32c sum;
+      for(std::uint64_t done = 0; done < entries[i].size;){
+        std::vector<char> buffer = buffers.pop();
+        if(buffer.empty()) return;
+        sum.update(buffer.data(), buffer.size());
+        out_file.write(buffer.data(), buffer.size());
+        done += buffer.size();
+      }
+      if(sum.value() != reader.index().entrySums[i]){
+        std::cout << "Checksum mismatch " << entries[i].name << std::endl;
+        intact = false;
+      }
+    }
+  });
+  std::uint64_t offset = 0;
+  for(ArchiveEntry const& entry : reader.header().entries){
+    if(!options.quiet) std::cout << "Extracting " << entry.name << std::endl;
+    for(std::uint64_t done = 0; done < entry.size;){
+      std::vector<char> buffer(std::min<std::uint64_t>(entry.size - done, 1 << 20));
+      if(!reader.read(offset, buffer.size(), buffer.data())){
+        std::cout << (reader.corrupt() ? "Checksum mismatch in " : "Can't decode ") << entry.name << std::endl;
+        buffers.push(std::vector<char>());
+        output.join();
+        return false;
+      }
+      offset += buffer.size();
+      done += buffer.size();
+      buffers.push(std::move(buffer));
     }
-    done++;
   }
+  output.join();
+  return intact;
+}
 
+// Decodes length bytes at offset of the archive content into name.part
+void extract_range(std::string const& filename, std::uint64_t offset, std::uint64_t length, Options const& options){
+  std::ifstream file(filename, std::ios::binary);
+  ArchiveReader reader(file, options.snapshot);
+  if(!reader.good()){
+    std::cout << "Not an archive " << filename << std::endl;
+    return;
+  }
+  std::vector<char> buffer(length);
+  if(!reader.read(offset, length, buffer.data())){
+    std::cout << (reader.corrupt() ? "Checksum mismatch in range " : "Can't decode range ") << offset << " + " << length << std::endl;
+    return;
+  }
+  std::ofstream out_file(filename + ".part", std::ios::binary);
+  out_file.write(buffer.data(), length);
 }
 
-void extract(std::string const& filename){
-  std::cout << "Extracting " << filename << std::endl;
-  std::ifstream file(filename);
+// --- Bit cost analysis ---
+// Streams the file through the model with bounded memory. Aggregate costs per
+// byte value, per line and per dominant context order go to name.stats, and
+// when html is set a coloured rendering of the file goes to name.html.
+
+struct LineCost {
+  std::uint64_t number, bytes, cost;
+  double bpc() const { return static_cast<double>(cost) / (bytes << 20); }
+  bool operator>(LineCost const& other) const { return bpc() > other.bpc(); }
+};
+
+void html_bpc(std::string const& filename, bool html){
+  std::cout << "bpc analysis for : " << filename << std::endl;
+  std::ifstream file(filename, std::ios::binary);
   if(!file.good()){
     std::cout << "Can't open file " << filename << std::endl;
     return;
   }
 
-  // --- Get original file length ---
+  // --- Open out files ---
+  std::ofstream stats_file(filename + ".stats");
+  std::ofstream html_file;
+  std::string html_buffer;
+  if(html){
+    html_file.open(filename + ".html", std::ios::binary);
+    html_buffer = "<html><body style=\"font-family:monospace;white-space:pre-wrap\">";
+  }
 
-  std::uint32_t file_length;
-  file.read((char*) &file_length, sizeof(std::uint32_t));
-  Decoder decoder(file);
+  // --- Statistics, all costs are FixedPoint20 bit counts ---
+  static constexpr unsigned LineHistogramSize = 17; // Half bpc buckets, the last one is >= 8
+  static constexpr unsigned WorstLineCount = 20;
+  static constexpr unsigned WorstLineMinBytes = 16;
+  std::array<std::uint64_t, 256> byte_count{}, byte_cost{};
+  std::vector<std::uint64_t> order_bits, order_cost;
+  std::array<std::uint64_t, LineHistogramSize> line_histogram{};
+  std::priority_queue<LineCost, std::vector<LineCost>, std::greater<LineCost>> worst_lines;
+  LineCost line = { 1, 0, 0 };
+  std::uint64_t total_cost = 0;
 
-  // --- Open out file ---
-  std::ofstream out_file(filename + ".orig");
+  auto end_line = [&](){
+    if(line.bytes == 0) return;
+    line_histogram[std::min<unsigned>(2.0 * line.bpc(), LineHistogramSize - 1)]++;
+    if(line.bytes >= WorstLineMinBytes){
+      worst_lines.push(line);
+      if(worst_lines.size() > WorstLineCount) worst_lines.pop();
+    }
+  };
 
   // --- Algo ---
-  BitRNAModel<16> rna;
+  CostTable const& costs = CostTable::get();
+  RNAModel<RNAContext> model;
+  std::vector<char> in_buffer(1 << 16);
+  std::uint64_t done = 0;
+  int last_colour = -1;
 
-  for(unsigned a = 0; a < file_length; ++a){
-    char ch = 0;
-    for(unsigned i = 0; i < 8; ++i){
-      std::uint32_t pred = rna.predict();
-      bool bit = decoder.decode(pred);
-      if(bit){
-        ch |= 1 << (7-i);
+  while(file.read(in_buffer.data(), in_buffer.size()) || file.gcount() > 0){
+    std::streamsize count = file.gcount();
+    for(std::streamsize c = 0; c < count; ++c){
+      if(done % (1 << 20) == 0) std::cout << done << std::endl;
+      unsigned char ch = in_buffer[c];
+      std::uint64_t cost = 0;
+
+      for(unsigned i = 0; i < 8; ++i){
+        bool bit = ch & (1 << (7-i));
+        std::uint32_t pred = model.predict();
+        std::uint32_t bit_cost = costs.cost(pred, bit).value();
+        cost += bit_cost;
+
+        // --- The order with the strongest weight gets the cost of the bit
+        unsigned dominant = 0;
+        std::int32_t strongest = -1;
+        model.iterateOnWeights([&](unsigned order, FixedPoint20 weight){
+          std::int32_t strength = weight.value() < 0 ? -weight.value() : weight.value();
+          if(strength > strongest){ strongest = strength; dominant = order; }
+        });
+        if(dominant >= order_bits.size()){
+          order_bits.resize(dominant + 1);
+          order_cost.resize(dominant + 1);
+        }
+        order_bits[dominant]++;
+        order_cost[dominant] += bit_cost;
+
+        model.update(bit);
+      }
+
+      total_cost += cost;
+      byte_count[ch]++;
+      byte_cost[ch] += cost;
+      line.bytes++;
+      line.cost += cost;
+      if(ch == '\n'){
+        end_line();
+        line = { line.number + 1, 0, 0 };
+      }
+
+      if(html){
+        int colour = std::min<std::uint64_t>(32, 32 * cost / (8 << 20));
+        if(colour != last_colour){
+          int r = 255 * colour / 32;
+          int g = 255 - r;
+          if(last_colour != -1) html_buffer += "</span>";
+          html_buffer += "<span style=\"background-color:rgb(" + std::to_string(r) + ", " + std::to_string(g) + ", 0);\">";
+          last_colour = colour;
+        }
+        switch(ch){
+        case '<': html_buffer += "&lt;"; break;
+        case '>': html_buffer += "&gt;"; break;
+        case '&': html_buffer += "&amp;"; break;
+        default: html_buffer += ch; break;
+        }
+        if(html_buffer.size() >= (1 << 20)){
+          html_file.write(html_buffer.data(), html_buffer.size());
+          html_buffer.clear();
+        }
       }
-      rna.update(bit);
+      done++;
     }
-    out_file.put(ch);
+  }
+  end_line();
+
+  if(html){
+    if(last_colour != -1) html_buffer += "</span>";
+    html_buffer += "</body></html>\n";
+    html_file.write(html_buffer.data(), html_buffer.size());
+  }
+
+  // --- Write statistics ---
+  auto bits = [](std::uint64_t cost){ return static_cast<double>(cost) / (1 << 20); };
+  stats_file << std::fixed << std::setprecision(3);
+  stats_file << "bytes " << done << " bits " << bits(total_cost) << " bpc " << (done ? bits(total_cost) / done : 0.0) << "\n";
+
+  stats_file << "\n--- Cost per byte value : value count bits bpc ---\n";
+  for(unsigned v = 0; v < 256; ++v){
+    if(byte_count[v] == 0) continue;
+    stats_file << v << " " << byte_count[v] << " " << bits(byte_cost[v]) << " " << bits(byte_cost[v]) / byte_count[v] << "\n";
+  }
+
+  stats_file << "\n--- Cost per dominant context order : order coded_bits bits bits_per_bit ---\n";
+  for(unsigned o = 0; o < order_bits.size(); ++o){
+    stats_file << o << " " << order_bits[o] << " " << bits(order_cost[o]) << " " << (order_bits[o] ? bits(order_cost[o]) / order_bits[o] : 0.0) << "\n";
+  }
+
+  stats_file << "\n--- Lines per bpc : bpc_from lines ---\n";
+  for(unsigned h = 0; h < LineHistogramSize; ++h){
+    stats_file << 0.5 * h << " " << line_histogram[h] << "\n";
+  }
+
+  stats_file << "\n--- Worst lines of at least " << WorstLineMinBytes << " bytes : line bytes bits bpc ---\n";
+  std::vector<LineCost> worst;
+  for(; !worst_lines.empty(); worst_lines.pop()) worst.push_back(worst_lines.top());
+  for(auto it = worst.rbegin(); it != worst.rend(); ++it){
+    stats_file << it->number << " " << it->bytes << " " << bits(it->cost) << " " << it->bpc() << "\n";
   }
 }
 
-void html_bpc(std::string const& filename){
-  std::cout << "html bpc for : " << filename << std::endl;
+void trace(std::string const& filename){
+  std::cout << "Tracing " << filename << std::endl;
   std::ifstream file(filename);
   if(!file.good()){
     std::cout << "Can't open file " << filename << std::endl;
     return;
   }
-  
-  // --- Get file size ---
-  file.seekg(0, std::ios::end);
-  std::uint32_t file_length = file.tellg();
-  file.seekg(0, std::ios::beg);
-
-  std::cout << "Size : " << file_length << std::endl;
 
   // --- Open out file ---
-
-  std::ofstream out_file(filename + ".html");
+  std::ofstream out_file(filename + ".trace");
 
   // --- Algo ---
-  char ch;
+  RNAModel<RNAContext> rna;
+  BitRNAModel<16> bitRna;
+  BitPPMModel<16> bitPpm;
+  IndirectModel<RNAContext> indirect;
+  std::vector<Model*> models = { &rna, &bitRna, &bitPpm, &indirect };
+  std::vector<std::uint32_t> preds(models.size());
+  TraceWriter writer(out_file, models.size());
 
-  RNAModel<RNAContext> model;
+  char ch;
   unsigned done = 0;
-  while(file.good() && !file.eof()){
+  while(file.get(ch)){
     if(done % 10000 == 0) std::cout << done << std::endl;
-    file.get(ch);
-
-    double bitcount = 0.0;
-
     for(unsigned i = 0; i < 8; ++i){
       bool bit = ch & (1 << (7-i));
-      std::uint32_t pred = model.predict();
-      double pred_double = static_cast<double>(pred) / static_cast<double>((std::uint64_t) 1 << 32);
-      double err = bit ? 1.0 - pred_double : pred_double;
-      bitcount -= std::log(1.0 - err) / std::log(2.0);
+      for(unsigned m = 0; m < models.size(); ++m){
+        preds[m] = models[m]->predict();
+      }
+      writer.write(preds.data(), bit);
+      for(Model* model : models){
+        model->update(bit);
+      }
+    }
+    done++;
+  }
+}
 
-      model.update(bit);
+// Codes the trace with the predictions of model (or of a mix of every model when
+// model == modelCount), checks the decoder agrees and reports size and time.
+void replay_one(std::string const& filename, unsigned model){
+  std::ifstream file(filename);
+  TraceReader reader(file);
+  std::vector<std::unique_ptr<TraceModel>> inputs;
+  std::vector<Model*> inputPtrs;
+  for(unsigned i = 0; i < reader.modelCount(); ++i){
+    inputs.emplace_back(new TraceModel(reader, i));
+    inputPtrs.push_back(inputs.back().get());
+  }
+  MixModel mix(inputPtrs);
+  Model& m = model < reader.modelCount() ? *inputs[model] : static_cast<Model&>(mix);
+
+  // --- Encode, remembering the predictions for the decoder ---
+  std::vector<std::uint32_t> preds;
+  std::vector<bool> bits;
+  std::ostringstream coded;
+  auto start = std::chrono::steady_clock::now();
+  {
+    Encoder encoder(coded);
+    while(reader.next()){
+      std::uint32_t pred = m.predict();
+      encoder.encode(reader.bit(), pred);
+      m.update(reader.bit());
+      preds.push_back(pred);
+      bits.push_back(reader.bit());
     }
-    int r = 255.0 * bitcount / 8.0;
-    int g = 255.0 * (1.0 - bitcount / 8.0);
-    int b = 0;
-    out_file << "<span style=\"background-color:rgb(" << r << ", " << g << ", " << b << ");\">" << ch << "</span>";
-    if(ch == '\n'){
-      out_file << "<br/>";
+  }
+  auto middle = std::chrono::steady_clock::now();
+
+  // --- Decode ---
+  std::istringstream in(coded.str());
+  Decoder decoder(in);
+  unsigned errors = 0;
+  for(unsigned i = 0; i < preds.size(); ++i){
+    if(decoder.decode(preds[i]) != bits[i]) errors++;
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  std::chrono::duration<double> encode_time = middle - start, decode_time = end - middle;
+  std::cout << (model < reader.modelCount() ? "model " + std::to_string(model) : std::string("mix"))
+    << " : " << coded.str().size() << " bytes, "
+    << (preds.empty() ? 0.0 : 8.0 * coded.str().size() / (preds.size() / 8)) << " bpc, "
+    << "encode " << encode_time.count() << "s, decode " << decode_time.count() << "s"
+    << (errors ? ", DECODER MISMATCH" : "") << std::endl;
+}
+
+void replay(std::string const& filename){
+  std::cout << "Replaying " << filename << std::endl;
+  std::ifstream file(filename);
+  TraceReader reader(file);
+  if(!reader.valid()){
+    std::cout << "Can't read trace " << filename << std::endl;
+    return;
+  }
+  for(unsigned i = 0; i <= reader.modelCount(); ++i){
+    replay_one(filename, i);
+  }
+}
+
+// Trains a model on the files and saves its state to the snapshot
+void prime(std::vector<std::string> const& filenames, Options const& options){
+  if(options.snapshot.empty()){
+    std::cout << "No snapshot file given" << std::endl;
+    return;
+  }
+  ModelType type = ModelType::Large;
+  if(!options.model.empty() && !parseModelType(options.model, type)){
+    std::cout << "Unknown model " << options.model << std::endl;
+    return;
+  }
+  std::unique_ptr<Model> modelPtr = makeModel(type, options.modelParameter);
+  Model& model = *modelPtr;
+  for(std::string const& filename : filenames){
+    std::cout << "Priming with " << filename << std::endl;
+    std::ifstream file(filename);
+    if(!file.good()){
+      std::cout << "Can't open file " << filename << std::endl;
+      continue;
     }
-    done++;
+    char ch;
+    while(file.get(ch)){
+      model.learn(ch);
+    }
+  }
+  std::ofstream out_file(options.snapshot);
+  SnapshotWriter writer(out_file);
+  if(!model.save(writer)){
+    std::cout << "Can't write snapshot " << options.snapshot << std::endl;
   }
 }
 
+// Codes the files with the per bit loop and with the byte path of the same
+// model, checks they agree and compares their speed, with the model tables on
+// small pages and on huge pages. The model is a type, or mix for the mix of
+// the golden digests, in parallel mode with -P.
+void benchmark(std::vector<std::string> const& filenames, Options const& options){
+  ModelType type = ModelType::Large;
+  std::string name = options.model.empty() ? modelName(type) : options.model;
+  std::function<std::unique_ptr<Model>()> make;
+  if(name == "mix"){
+    bool parallel = options.parallel;
+    make = [=](){ return std::unique_ptr<Model>(new GoldenMix(parallel)); };
+    if(parallel) name += ", parallel";
+  }else if(parseModelType(name, type)){
+    make = [&](){ return makeModel(type, options.modelParameter); };
+  }else{
+    std::cout << "Unknown model " << name << std::endl;
+    return;
+  }
+  for(std::string const& filename : filenames){
+    std::ifstream file(filename, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if(data.empty()) continue;
+    std::cout << filename << " : " << data.size() << " bytes, model " << name << std::endl;
+    std::array<std::string, 4> coded;
+    for(unsigned run = 0; run < 4; ++run){
+      unsigned path = run % 2;
+      bool huge = run >= 2;
+      PageAllocator::setHugePages(huge);
+      std::unique_ptr<Model> model = make();
+      // --- Encode ---
+      model->reset();
+      std::ostringstream out;
+      auto start = std::chrono::steady_clock::now();
+      {
+        Encoder encoder(out);
+        for(char ch : data){
+          if(path == 1){
+            model->encode(encoder, ch);
+            continue;
+          }
+          for(unsigned i = 0; i < 8; ++i){
+            bool bit = ch & (1 << (7-i));
+            encoder.encode(bit, model->predict());
+            model->update(bit);
+          }
+        }
+      }
+      auto middle = std::chrono::steady_clock::now();
+      coded[run] = out.str();
+      if(path == 1){
+        // Every page the model uses is resident by now
+        std::cout << (huge ? "  huge pages :\n" : "  small pages :\n");
+        std::istringstream pages(PageAllocator::report());
+        for(std::string line; std::getline(pages, line);) std::cout << "    " << line << std::endl;
+      }
+
+      // --- Decode ---
+      model->reset();
+      std::istringstream in(coded[run]);
+      Decoder decoder(in);
+      unsigned errors = 0;
+      auto restart = std::chrono::steady_clock::now();
+      for(char ch : data){
+        unsigned char decoded = 0;
+        if(path == 1){
+          decoded = model->decode(decoder);
+        }else{
+          for(unsigned i = 0; i < 8; ++i){
+            bool bit = decoder.decode(model->predict());
+            decoded |= bit << (7-i);
+            model->update(bit);
+          }
+        }
+        errors += decoded != static_cast<unsigned char>(ch);
+      }
+      auto end = std::chrono::steady_clock::now();
+
+      std::chrono::duration<double> encode_time = middle - start, decode_time = end - restart;
+      std::cout << (path == 0 ? "  bit loop  : " : "  byte path : ") << coded[run].size() << " bytes, encode "
+        << data.size() / encode_time.count() / 1e6 << " MB/s, decode "
+        << data.size() / decode_time.count() / 1e6 << " MB/s"
+        << (errors ? ", DECODER MISMATCH" : "") << std::endl;
+    }
+    if(coded[0] != coded[1] || coded[0] != coded[2] || coded[0] != coded[3]){
+      std::cout << "  OUTPUT MISMATCH" << std::endl;
+    }
+    PageAllocator::setHugePages(true);
+  }
+}
+
+// Size the order 16 BitPPMModel codes the files to, and its speed, for each
+// window and table size, against the node tree it replaced on the same
+// window. The 17 bit window is the one the trace and the golden mix used
+// before DefaultWindow.
+void ppm_benchmark(std::vector<std::string> const& filenames){
+  static unsigned const windows [] = { 17, 1 << 12, 1 << 16, 1 << 20 };
+  static unsigned const tableBits [] = { 18, 22 };
+  CostTable const& costs = CostTable::get();
+  std::vector<std::vector<char>> files;
+  std::uint64_t total = 0;
+  for(std::string const& filename : filenames){
+    std::ifstream file(filename, std::ios::binary);
+    if(!file.good()){
+      std::cout << "Can't open file " << filename << std::endl;
+      return;
+    }
+    files.emplace_back((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    total += files.back().size();
+  }
+  auto measure = [&](Model& model, std::string const& name){
+    std::uint64_t cost = 0;
+    std::uint32_t predictions[8];
+    auto start = std::chrono::steady_clock::now();
+    for(std::vector<char> const& file : files){
+      model.reset();
+      for(char ch : file){
+        unsigned char byte = ch;
+        model.predictByte(byte, predictions);
+        for(unsigned i = 0; i < 8; ++i){
+          cost += costs.cost(predictions[i], byte & (0x80 >> i)).value();
+        }
+      }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "    " << name << " : " << (cost >> 23) << " bytes, " << total / elapsed.count() / 1e6 << " MB/s" << std::endl;
+  };
+  std::cout << files.size() << " files, " << total << " bytes" << std::endl;
+  for(unsigned window : windows){
+    std::cout << "  window " << window << " bits" << (window == BitPPMModel<16>::DefaultWindow ? ", the default" : "") << std::endl;
+    {
+      BitPPMTreeModel<16> tree(window);
+      measure(tree, "node tree");
+    }
+    for(unsigned bits : tableBits){
+      BitPPMModel<16> model(window, bits);
+      measure(model, "table 2^" + std::to_string(bits));
+    }
+  }
+}
+
+// Checks the fixed point operations, then the prediction digests of every
+// model against the golden ones, on the sample and the Calgary prefixes
+// found under calgary/, or prints the digests on the files. False on a
+// mismatch.
+bool golden(std::vector<std::string> const& filenames){
+  std::vector<GoldenInput> inputs;
+  if(filenames.empty()){
+    inputs = goldenInputs("calgary");
+  }
+  for(std::string const& filename : filenames){
+    std::ifstream file(filename, std::ios::binary);
+    inputs.push_back({ filename, std::vector<unsigned char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()) });
+  }
+  unsigned failures = 0;
+  if(filenames.empty()){
+    unsigned fixedPoint = fixedPointFailures();
+    std::cout << "fixed point : " << (fixedPoint ? std::to_string(fixedPoint) + " failures" : std::string("ok")) << std::endl;
+    failures += fixedPoint;
+  }
+  for(std::size_t k = 0; k < inputs.size(); ++k){
+    GoldenInput const& input = inputs[k];
+    if(input.data.empty()){
+      std::cout << input.name << " : missing, skipped" << std::endl;
+      continue;
+    }
+    std::cout << input.name << " : " << input.data.size() << " bytes" << std::endl;
+    for(GoldenModel const& golden : goldenModels()){
+      std::unique_ptr<Model> model = golden.make();
+      std::uint64_t digest = predictionDigest(*model, input.data);
+      std::cout << "  " << golden.name << " : 0x" << std::hex << std::setw(16) << std::setfill('0') << digest << std::dec;
+      if(filenames.empty()){
+        failures += digest != golden.digests[k];
+        std::cout << (digest == golden.digests[k] ? " ok" : " MISMATCH");
+      }
+      std::cout << std::endl;
+    }
+  }
+  if(filenames.empty()){
+    std::cout << (failures ? "Predictions differ from the golden ones" : "All predictions match") << std::endl;
+  }
+  return failures == 0;
+}
+
 // --- Argument parsing ---
 
+// Serves compress and decompress requests on the socket until a stop request,
+// with warm models of the -m type
+void serve(std::vector<std::string> const& args, Options const& options){
+  if(args.size() != 1){
+    std::cout << "Usage : d socket [-m model] [-j workers] [-M megabytes]" << std::endl;
+    return;
+  }
+  ModelType type = ModelType::Small;
+  if(!options.model.empty() && !parseModelType(options.model, type)){
+    std::cout << "Unknown model " << options.model << std::endl;
+    return;
+  }
+  ModelPool pool(options.memory);
+  pool.warm(type, options.modelParameter, options.threads);
+  Daemon daemon(args[0], pool, options.threads);
+  if(!daemon.good()){
+    std::cout << "Can't listen on " << args[0] << " : " << daemon.error() << std::endl;
+    return;
+  }
+  std::cout << "Listening on " << args[0] << ", " << pool.report();
+  daemon.run();
+  std::cout << "Stopped" << std::endl;
+}
+
+// Client of serve() : c files (to name.out, or -o with one file),
+// x files (to name.orig), stats, stop
+void query(std::vector<std::string> const& args, Options const& options){
+  if(args.size() < 2){
+    std::cout << "Usage : q socket c|x|stats|stop [files]" << std::endl;
+    return;
+  }
+  ModelType type = ModelType::Small;
+  if(!options.model.empty() && !parseModelType(options.model, type)){
+    std::cout << "Unknown model " << options.model << std::endl;
+    return;
+  }
+  int fd = connectDaemon(args[0]);
+  if(fd < 0){
+    std::cout << "Can't connect to " << args[0] << std::endl;
+    return;
+  }
+  std::string const& command = args[1];
+  std::vector<char> reply;
+  DaemonStatus status;
+  if(command == "stats" || command == "stop"){
+    DaemonCommand c = command == "stats" ? DaemonCommand::Stats : DaemonCommand::Stop;
+    if(sendRequest(fd, c, type, 0, nullptr, 0) && receiveReply(fd, status, reply)){
+      std::cout << std::string(reply.begin(), reply.end());
+    }
+  }else if(command == "c" || command == "x"){
+    bool compress = command == "c";
+    std::uint64_t in = 0, out = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned i = 2; i < args.size(); ++i){
+      std::ifstream file(args[i], std::ios::binary);
+      std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+      auto sent = std::chrono::steady_clock::now();
+      if(!sendRequest(fd, compress ? DaemonCommand::Compress : DaemonCommand::Decompress, type, options.modelParameter, data.data(), data.size())
+        || !receiveReply(fd, status, reply)){
+        std::cout << "Connection lost" << std::endl;
+        break;
+      }
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - sent;
+      if(status != DaemonStatus::Ok){
+        std::cout << args[i] << " : failed, status " << static_cast<unsigned>(status) << std::endl;
+        continue;
+      }
+      std::string name = !options.output.empty() && args.size() == 3 ? options.output : args[i] + (compress ? ".out" : ".orig");
+      std::ofstream(name, std::ios::binary).write(reply.data(), reply.size());
+      std::cout << args[i] << " : " << data.size() << " -> " << reply.size() << " bytes, " << 1000.0 * elapsed.count() << " ms" << std::endl;
+      in += data.size();
+      out += reply.size();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Total : " << in << " -> " << out << " bytes, " << elapsed.count() << " s" << std::endl;
+  }else{
+    std::cout << "Unknown request " << command << std::endl;
+  }
+  ::close(fd);
+}
+
+// Archives each file alone (a), or extracts each archive (x), on -j workers
+// within the -M memory budget
+void jobs(std::vector<std::string> const& args, Options options){
+  if(args.empty() || (args[0] != "a" && args[0] != "x")){
+    std::cout << "Usage : j a|x files [-j workers] [-M megabytes]" << std::endl;
+    return;
+  }
+  // Reader and coder buffers of a job, besides the model
+  static constexpr std::uint64_t JobMemory = 16 << 20;
+  options.quiet = true;
+  options.output.clear();
+  JobScheduler scheduler(options.threads, options.memory);
+  for(unsigned i = 1; i < args.size(); ++i){
+    std::string const& name = args[i];
+    if(args[0] == "a"){
+      // The model must be known for the admission, plan now and code later
+      std::cout << "Planning " << name << std::endl;
+      std::shared_ptr<ArchiveHeader> header = std::make_shared<ArchiveHeader>();
+      if(!plan_archive({ name }, options, *header) || header->entries.empty()) continue;
+      std::uint64_t memory = modelMemory(static_cast<ModelType>(header->modelType)) + JobMemory;
+      scheduler.add({ name, header->totalSize(), memory, [=](){
+        return write_archive(*header, name + ".out", options);
+      }});
+    }else{
+      std::ifstream file(name, std::ios::binary);
+      ArchiveHeader header;
+      if(!header.read(file) || !validModelType(header.modelType)){
+        std::cout << "Not an archive " << name << std::endl;
+        continue;
+      }
+      std::uint64_t memory = modelMemory(static_cast<ModelType>(header.modelType)) + JobMemory;
+      scheduler.add({ name, header.totalSize(), memory, [=](){
+        return extract(name, options);
+      }});
+    }
+  }
+  scheduler.run();
+}
+
+// Searches the settings of a model on the files, see Tuner
+void tune(std::vector<std::string> const& filenames, Options const& options){
+  TuneTarget target;
+  std::string name = options.model.empty() ? "small" : options.model;
+  if(!parseTuneTarget(name, options.modelParameter, target)){
+    std::cout << "Unknown model " << name << std::endl;
+    return;
+  }
+  std::vector<std::vector<char>> corpus;
+  for(std::string const& filename : filenames){
+    std::ifstream file(filename, std::ios::binary);
+    if(!file.good()){
+      std::cout << "Can't open file " << filename << std::endl;
+      return;
+    }
+    corpus.emplace_back((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  }
+  if(corpus.empty()) return;
+  Tuner tuner(target, std::move(corpus));
+  tuner.run(4, options.threads, options.memory);
+}
+
 void help(){
-  std::cout << "Help, TODO" << std::endl;
+  std::cout <<
+    "Usage : tipe.out mode [options] files\n"
+    "Modes :\n"
+    "  a files           archive the files, to -o or the first name + .out\n"
+    "  x archives        extract every entry, to name.orig\n"
+    "  e archive off len extract a range of the content, to archive.part\n"
+    "  b files           bit cost analysis, to name.stats and name.html\n"
+    "  s files           bit cost analysis, to name.stats\n"
+    "  t files           trace the predictions of the models, to name.trace\n"
+    "  r traces          replay a trace through each model and their mix\n"
+    "  p files           prime a model on the files, to the -s snapshot\n"
+    "  c files           benchmark the bit loop and the byte path of -m, or\n"
+    "                    of the golden mix with -m mix\n"
+    "  k files           compare windows and tables of the bit PPM model, and\n"
+    "                    its former node tree\n"
+    "  g [files]         check the golden prediction digests, from the\n"
+    "                    directory holding calgary/, or print them on files\n"
+    "  d socket          serve compression requests on a Unix socket\n"
+    "  q socket request  query the daemon : c files, x files, stats or stop\n"
+    "  j a|x files       archive each file alone, or extract each archive, as\n"
+    "                    parallel jobs\n"
+    "  u files           tune the settings of -m on the files : a model type,\n"
+    "                    bitrna, bitppm, byteppm or mix\n"
+    "Options :\n"
+    "  -o name           archive name\n"
+    "  -s snapshot       initial model state, or primed model output\n"
+    "  -b KB             independently decodable blocks\n"
+    "  -m type[:param]   model type : large, small, simple, records, flat,\n"
+    "                    compact, indirect\n"
+    "  -f filter         filter : none, e8e9, delta:N, split:N[le|be]\n"
+    "  -w words          dictionary size limit, 0 for none\n"
+    "  -j workers        daemon workers, or jobs or tuner runs at once\n"
+    "  -M MB             daemon, jobs or tuner model memory budget\n"
+    "  -P                benchmarked mix with a thread per model\n";
 }
 
 
@@ -152,7 +983,19 @@ enum class ProgramOption {
   Help,
   Archive,
   Extract,
-  HTMLBPC
+  HTMLBPC,
+  BPCStats,
+  Trace,
+  Replay,
+  Prime,
+  ExtractRange,
+  Benchmark,
+  Golden,
+  Serve,
+  Query,
+  Jobs,
+  Tune,
+  PPMBenchmark
 };
 
 int main(int argc, char** argv){
@@ -164,10 +1007,66 @@ int main(int argc, char** argv){
   if(!args.empty()){
     if(args[0] == "a"){
       option = ProgramOption::Archive;
-    }if(args[0] == "b"){
+    }else if(args[0] == "b"){
       option = ProgramOption::HTMLBPC;
+    }else if(args[0] == "s"){
+      option = ProgramOption::BPCStats;
     }else if(args[0] == "x"){
       option = ProgramOption::Extract;
+    }else if(args[0] == "t"){
+      option = ProgramOption::Trace;
+    }else if(args[0] == "r"){
+      option = ProgramOption::Replay;
+    }else if(args[0] == "p"){
+      option = ProgramOption::Prime;
+    }else if(args[0] == "e"){
+      option = ProgramOption::ExtractRange;
+    }else if(args[0] == "c"){
+      option = ProgramOption::Benchmark;
+    }else if(args[0] == "g"){
+      option = ProgramOption::Golden;
+    }else if(args[0] == "d"){
+      option = ProgramOption::Serve;
+    }else if(args[0] == "q"){
+      option = ProgramOption::Query;
+    }else if(args[0] == "j"){
+      option = ProgramOption::Jobs;
+    }else if(args[0] == "u"){
+      option = ProgramOption::Tune;
+    }else if(args[0] == "k"){
+      option = ProgramOption::PPMBenchmark;
+    }
+  }
+  // --- Options, then files ---
+  Options options;
+  std::vector<std::string> files;
+  for(unsigned i = 1; i < args.size(); ++i){
+    if(args[i] == "-s" && i + 1 < args.size()){
+      options.snapshot = args[++i];
+    }else if(args[i] == "-b" && i + 1 < args.size()){
+      options.blockSize = std::stoull(args[++i]) << 10;
+    }else if(args[i] == "-m" && i + 1 < args.size()){
+      // type, or type:parameter
+      options.model = args[++i];
+      std::size_t colon = options.model.find(':');
+      if(colon != std::string::npos){
+        options.modelParameter = std::stoul(options.model.substr(colon + 1));
+        options.model.resize(colon);
+      }
+    }else if(args[i] == "-w" && i + 1 < args.size()){
+      options.words = std::stoul(args[++i]);
+    }else if(args[i] == "-f" && i + 1 < args.size()){
+      options.filter = args[++i];
+    }else if(args[i] == "-j" && i + 1 < args.size()){
+      options.threads = std::stoul(args[++i]);
+    }else if(args[i] == "-M" && i + 1 < args.size()){
+      options.memory = std::stoull(args[++i]) << 20;
+    }else if(args[i] == "-P"){
+      options.parallel = true;
+    }else if(args[i] == "-o" && i + 1 < args.size()){
+      options.output = args[++i];
+    }else{
+      files.push_back(args[i]);
     }
   }
   switch(option){
@@ -175,19 +1074,60 @@ int main(int argc, char** argv){
     help();
     break;
   case ProgramOption::Archive:
-    for(unsigned i = 1; i < args.size(); ++i){
-      archive(args[i]);
-    }
+    archive(files, options);
     break;
   case ProgramOption::HTMLBPC:
-    for(unsigned i = 1; i < args.size(); ++i){
-      html_bpc(args[i]);
+    for(std::string const& file : files){
+      html_bpc(file, true);
+    }
+    break;
+  case ProgramOption::BPCStats:
+    for(std::string const& file : files){
+      html_bpc(file, false);
     }
     break;
   case ProgramOption::Extract:
-    for(unsigned i = 1; i < args.size(); ++i){
-      extract(args[i]);
+    for(std::string const& file : files){
+      extract(file, options);
     }
     break;
+  case ProgramOption::Trace:
+    for(std::string const& file : files){
+      trace(file);
+    }
+    break;
+  case ProgramOption::Replay:
+    for(std::string const& file : files){
+      replay(file);
+    }
+    break;
+  case ProgramOption::Prime:
+    prime(files, options);
+    break;
+  case ProgramOption::ExtractRange:
+    if(files.size() == 3){
+      extract_range(files[0], std::stoull(files[1]), std::stoull(files[2]), options);
+    }
+    break;
+  case ProgramOption::Benchmark:
+    benchmark(files, options);
+    break;
+  case ProgramOption::Golden:
+    return golden(files) ? 0 : 1;
+  case ProgramOption::Serve:
+    serve(files, options);
+    break;
+  case ProgramOption::Query:
+    query(files, options);
+    break;
+  case ProgramOption::Jobs:
+    jobs(files, options);
+    break;
+  case ProgramOption::Tune:
+    tune(files, options);
+    break;
+  case ProgramOption::PPMBenchmark:
+    ppm_benchmark(files);
+    break;
   }
 }
\ No newline at end of file
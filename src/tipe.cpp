@@ -0,0 +1,77 @@
+#include "tipe.h"
+#include "Compressor.h"
+
+struct tipe_context {
+  Compressor compressor;
+};
+
+static tipe_status status(Compressor::Status status){
+  switch(status){
+  case Compressor::Status::Ok:
+    return TIPE_OK;
+  case Compressor::Status::OutputTooSmall:
+    return TIPE_OUTPUT_TOO_SMALL;
+  case Compressor::Status::Corrupt:
+    return TIPE_CORRUPT;
+  }
+  return TIPE_CORRUPT;
+}
+
+// Exceptions must not cross into C : std::bad_alloc, as a corrupt header
+// can ask for any size, and whatever else the standard library throws
+template<typename Call>
+static tipe_status guarded(Call call){
+  try{
+    return call();
+  }catch(...){
+    return TIPE_ERROR;
+  }
+}
+
+extern "C" {
+
+tipe_context* tipe_create(char const* model, uint32_t parameter){
+  ModelType type;
+  if(!model || !parseModelType(model, type)) return nullptr;
+  try{
+    return new tipe_context{ Compressor(type, parameter) };
+  }catch(...){
+    return nullptr;
+  }
+}
+
+void tipe_destroy(tipe_context* context){
+  delete context;
+}
+
+size_t tipe_compress_bound(size_t size){
+  return Compressor::bound(size);
+}
+
+tipe_status tipe_content_size(void const* src, size_t src_size, uint64_t* size){
+  return guarded([&](){
+    return Compressor::contentSize(static_cast<char const*>(src), src_size, *size) ? TIPE_OK : TIPE_CORRUPT;
+  });
+}
+
+tipe_status tipe_compress(tipe_context* context, void const* src, size_t src_size, void* dst, size_t dst_capacity, size_t* dst_size){
+  return guarded([&](){
+    return status(context->compressor.compress(static_cast<char const*>(src), src_size, static_cast<char*>(dst), dst_capacity, *dst_size));
+  });
+}
+
+tipe_status tipe_decompress(tipe_context* context, void const* src, size_t src_size, void* dst, size_t dst_capacity, size_t* dst_size){
+  return guarded([&](){
+    return status(context->compressor.decompress(static_cast<char const*>(src), src_size, static_cast<char*>(dst), dst_capacity, *dst_size));
+  });
+}
+
+void tipe_reset(tipe_context* context){
+  // The model is only reset on the next call then
+  try{
+    context->compressor.reset();
+  }catch(...){
+  }
+}
+
+}
@@ -0,0 +1,49 @@
+#ifndef TIPE_H
+#define TIPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* --- C API ---
+ * In process compression of buffers into caller memory. A context keeps its
+ * model from one call to the next and resets it in place, create one per
+ * thread and reuse it. Compressed buffers are archives with a single
+ * unnamed entry, tipe.out x reads them too. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tipe_context tipe_context;
+
+typedef enum {
+  TIPE_OK = 0,
+  TIPE_OUTPUT_TOO_SMALL,
+  TIPE_CORRUPT,
+  TIPE_ERROR /* Out of memory, or another failure of the library */
+} tipe_status;
+
+/* model is a model type name of the command line, "large", "small",
+   "simple", "records", "flat", "compact" or "indirect", and parameter its
+   parameter (the record stride). NULL on an unknown model, or without
+   memory. */
+tipe_context* tipe_create(char const* model, uint32_t parameter);
+void tipe_destroy(tipe_context* context);
+
+/* Largest compressed size of size bytes */
+size_t tipe_compress_bound(size_t size);
+
+/* Decompressed size of a compressed buffer, TIPE_CORRUPT if it is not one */
+tipe_status tipe_content_size(void const* src, size_t src_size, uint64_t* size);
+
+tipe_status tipe_compress(tipe_context* context, void const* src, size_t src_size, void* dst, size_t dst_capacity, size_t* dst_size);
+tipe_status tipe_decompress(tipe_context* context, void const* src, size_t src_size, void* dst, size_t dst_capacity, size_t* dst_size);
+
+/* Resets the model now rather than on the next call, giving its pages back */
+void tipe_reset(tipe_context* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
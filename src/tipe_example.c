@@ -0,0 +1,78 @@
+/* Round trip of files through the C API of libtipe.a, with one context for
+ * every file, as an example and a check of the library :
+ *   tipe_example model files
+ * Exits with 1 when a file does not come back the same. */
+
+#include "tipe.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char* read_file(char const* name, size_t* size){
+  FILE* file = fopen(name, "rb");
+  char* data = NULL;
+  long length;
+  if(!file) return NULL;
+  if(fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) >= 0 && fseek(file, 0, SEEK_SET) == 0){
+    data = malloc(length + 1);
+    if(data && fread(data, 1, length, file) != (size_t) length){
+      free(data);
+      data = NULL;
+    }
+    *size = length;
+  }
+  fclose(file);
+  return data;
+}
+
+/* 0 when the file comes back the same */
+static int round_trip(tipe_context* context, char const* name){
+  size_t size = 0, capacity, compressed = 0, restored = 0;
+  uint64_t content = 0;
+  char* data = read_file(name, &size);
+  char* out;
+  char* back;
+  int failed = 1;
+  if(!data){
+    printf("%s : can't read\n", name);
+    return 1;
+  }
+  capacity = tipe_compress_bound(size);
+  out = malloc(capacity);
+  back = malloc(size + 1);
+  if(out && back
+    && tipe_compress(context, data, size, out, capacity, &compressed) == TIPE_OK
+    && tipe_content_size(out, compressed, &content) == TIPE_OK && content == size
+    && tipe_decompress(context, out, compressed, back, size, &restored) == TIPE_OK
+    && restored == size && memcmp(data, back, size) == 0){
+    printf("%s : %zu bytes to %zu\n", name, size, compressed);
+    failed = 0;
+  }else{
+    printf("%s : round trip failed\n", name);
+  }
+  free(data);
+  free(out);
+  free(back);
+  return failed;
+}
+
+int main(int argc, char** argv){
+  tipe_context* context;
+  int failures = 0;
+  int i;
+  if(argc < 3){
+    printf("Usage : tipe_example model files\n");
+    return 1;
+  }
+  context = tipe_create(argv[1], 0);
+  if(!context){
+    printf("Unknown model %s\n", argv[1]);
+    return 1;
+  }
+  for(i = 2; i < argc; ++i){
+    failures += round_trip(context, argv[i]);
+  }
+  tipe_destroy(context);
+  return failures ? 1 : 0;
+}